@@ -0,0 +1,66 @@
+// Bryan Jones and Melanie Subbiah (2014)
+// All rights reserved
+
+#include <stdio.h>
+#include <cassert>
+#include <algorithm>
+#include "Animation.h"
+#include "math3d.h"
+
+void ParameterTrack::addKey(int frame, const FrameParameters& p) {
+    const size_t i = std::lower_bound(m_frame.begin(), m_frame.end(), frame) - m_frame.begin();
+    if ((i < m_frame.size()) && (m_frame[i] == frame)) {
+        m_key[i] = p;
+    } else {
+        m_frame.insert(m_frame.begin() + i, frame);
+        m_key.insert(m_key.begin() + i, p);
+    }
+}
+
+
+FrameParameters ParameterTrack::operator()(float frame) const {
+    assert(! empty());
+    if (frame <= float(m_frame.front())) { return m_key.front(); }
+    if (frame >= float(m_frame.back())) { return m_key.back(); }
+
+    // First key after frame
+    const size_t i = std::upper_bound(m_frame.begin(), m_frame.end(), int(floor(frame))) - m_frame.begin();
+    const FrameParameters& a = m_key[i - 1];
+    const FrameParameters& b = m_key[i];
+    const float t = (frame - float(m_frame[i - 1])) / float(m_frame[i] - m_frame[i - 1]);
+
+    return FrameParameters(mix(a.yaw, b.yaw, t), mix(a.pitch, b.pitch, t), mix(a.roll, b.roll, t),
+                           mix(a.power, b.power, t), mix(a.zoom, b.zoom, t));
+}
+
+
+ParameterTrack ParameterTrack::turntable(int frameCount, const FrameParameters& start) {
+    assert(frameCount > 0);
+    ParameterTrack track;
+    FrameParameters end = start;
+    end.yaw += 2.0f * float(M_PI);
+    track.addKey(0, start);
+    track.addKey(frameCount, end);
+    return track;
+}
+
+
+bool ParameterTrack::load(const std::string& filename) {
+    FILE* file = fopen(filename.c_str(), "r");
+    if (file == NULL) { return false; }
+
+    bool ok = true;
+    char line[512];
+    while (ok && (fgets(line, sizeof(line), file) != NULL)) {
+        const char* p = line;
+        while ((*p == ' ') || (*p == '\t')) { ++p; }
+        if ((*p == '#') || (*p == '\n') || (*p == '\r') || (*p == '\0')) { continue; }
+
+        int frame;
+        FrameParameters key;
+        ok = (sscanf(p, "%d %f %f %f %f %f", &frame, &key.yaw, &key.pitch, &key.roll, &key.power, &key.zoom) == 6);
+        if (ok) { addKey(frame, key); }
+    }
+    fclose(file);
+    return ok && ! empty();
+}
@@ -0,0 +1,57 @@
+// Bryan Jones and Melanie Subbiah (2014)
+// All rights reserved
+
+#ifndef Animation_h
+#define Animation_h
+
+#include <string>
+#include <vector>
+
+/** Scene parameters of one animation frame. Angles are in radians. */
+class FrameParameters {
+public:
+    float yaw;
+    float pitch;
+    float roll;
+
+    /* Mandelbulb power */
+    float power;
+
+    /* Passed to drawRayCastImage() */
+    float zoom;
+
+    FrameParameters(float yaw = 0.0f, float pitch = 0.0f, float roll = 0.0f, float power = 8.0f, float zoom = 1.0f) :
+        yaw(yaw), pitch(pitch), roll(roll), power(power), zoom(zoom) {}
+};
+
+
+/** Keyframed FrameParameters, linearly interpolated between keys and
+    held constant before the first and after the last */
+class ParameterTrack {
+private:
+
+    /* Sorted by frame */
+    std::vector<int>                m_frame;
+    std::vector<FrameParameters>    m_key;
+
+public:
+
+    /** Adds a key at frame, replacing any key already there */
+    void addKey(int frame, const FrameParameters& p);
+
+    bool empty() const { return m_key.empty(); }
+
+    /** Requires at least one key */
+    FrameParameters operator()(float frame) const;
+
+    /** One full turn of yaw over frameCount frames, ending one frame
+        short of the start so that the sequence loops seamlessly */
+    static ParameterTrack turntable(int frameCount, const FrameParameters& start);
+
+    /** Reads keys from a text file of lines "frame yaw pitch roll power zoom".
+        Blank lines and lines starting with # are ignored. Returns false if
+        the file cannot be read, a line is malformed, or there are no keys. */
+    bool load(const std::string& filename);
+};
+
+#endif
@@ -2,26 +2,72 @@
 
 #include <GL/glut.h>
 #include <cassert>
+#include <cctype>
+#include <chrono>
 #include <stdio.h>
 #include "App.h"
+#include "ImageWriter.h"
+#include "Stats.h"
+#include "TileFarm.h"
+#include "Animation.h"
 
 const float App::minimumDistanceToSurface = 0.0003f;
+const float App::SURFACE_FOOTPRINT_FRACTION = 0.25f;
 
 App* App::instance = NULL;
 static const float deviceGamma = 2.1f;
 static const float fps = 30.0f;
 
+/* Camera rotation per pixel of mouse drag, in radians */
+static const float dragRadiansPerPixel = 0.01f;
 
-App::App(const std::string& windowCaption, int imageWidth, int imageHeight, float zoom, float exposureConstant, float imageGamma) : 
+/* Zoom factor per wheel click */
+static const float wheelZoomFactor = 1.1f;
+
+/* The view is considered to be changing for this long after a wheel click */
+static const long long wheelInteractionMilliseconds = 250;
+
+/* freeglut reports the wheel as these buttons */
+static const int wheelUpButton = 3;
+static const int wheelDownButton = 4;
+
+
+static long long currentMilliseconds() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+
+App::App(const std::string& windowCaption, int imageWidth, int imageHeight, float zoom, float exposureConstant, float imageGamma,
+         Framebuffer::Format imageFormat) : 
     m_windowCaption(windowCaption), m_zoom(zoom), m_exposureConstant(exposureConstant), m_imageGamma(imageGamma),
     m_frameTimeMilliseconds(int(1000.0f / fps + 0.5f)),
-    m_imageWidth(imageWidth), m_imageHeight(imageHeight) {
+    m_outputGamma(exposureConstant, deviceGamma / imageGamma),
+    m_displayFrame(imageWidth, imageHeight, imageFormat, exposureConstant),
+    m_readyFrame(imageWidth, imageHeight, imageFormat, exposureConstant),
+    m_readyFrameIsNew(false), m_asyncRendering(false), m_quit(false), m_inputGeneration(0), m_frameGeneration(0),
+    m_scheduler(imageWidth, imageHeight, m_frameTimeMilliseconds),
+    m_dragStartX(0), m_dragStartY(0), m_dragging(false), m_lastWheelMilliseconds(0),
+    m_framebuffer(imageWidth, imageHeight, imageFormat, exposureConstant),
+    m_imageWidth(imageWidth), m_imageHeight(imageHeight), m_mouseX(0), m_mouseY(0) {
 
     assert((imageWidth > 0) && (imageHeight > 0));
     assert(zoom > 0);
-    m_imageData.resize(m_imageWidth * m_imageHeight);
     instance = this;
 
+    // The vignette (from iq https://www.shadertoy.com/view/MdX3Rr) is
+    // pow((x + 1)(y + 1)(x - 1)(y - 1), 0.2) on [-1, 1]^2, which separates
+    // into a factor per axis. Tabulate them so that no pixel calls pow().
+    m_vignetteX.resize(2 * imageWidth + 1);
+    for (int i = 0; i < int(m_vignetteX.size()); ++i) {
+        const float x = float(i) / float(imageWidth) - 1.0f;
+        m_vignetteX[i] = pow(max(1.0f - x * x, 0.0f), 0.2f);
+    }
+    m_vignetteY.resize(2 * imageHeight + 1);
+    for (int i = 0; i < int(m_vignetteY.size()); ++i) {
+        const float y = float(i) / float(imageHeight) - 1.0f;
+        m_vignetteY[i] = pow(max(1.0f - y * y, 0.0f), 0.2f);
+    }
+
 
     //************* CHANGED THESE VALUES TO PLAY WITH COLORS ***********************
     //m_lightDirection = normalize(Vector3(1, 1, -1));
@@ -52,32 +98,19 @@ void App::run() {
     glutCreateWindow(m_windowCaption.c_str());
     glutKeyboardFunc(&staticOnKeyPress);
     glutDisplayFunc(&staticOnGraphics);
-    glutMotionFunc(&staticOnMouseMotion);
+    glutMouseFunc(&staticOnMousePress);
+    glutMotionFunc(&staticOnMouseDrag);
     glutPassiveMotionFunc(&staticOnMouseMotion);
     glutReshapeFunc(&staticReshape);
 
-    // Set the color scale applied as textures are uploaded to be the exposure constant
-    glMatrixMode(GL_COLOR);
-    glLoadIdentity();
-    glScalef(m_exposureConstant, m_exposureConstant, m_exposureConstant);
-
-    // Create a gamma correction color table for texture load
-    if (m_imageGamma != deviceGamma) {
-        const float gamma = deviceGamma / m_imageGamma;
-        std::vector<Color> gammaTable(256);
-        for (unsigned int i = 0; i < gammaTable.size(); ++i) {
-            gammaTable[i] = pow(Color::white() * i / (gammaTable.size() - 1.0f), 1.0f / gamma);
-        }
-        glColorTable(GL_POST_COLOR_MATRIX_COLOR_TABLE, GL_RGB, gammaTable.size(), GL_RGB, GL_FLOAT, &gammaTable[0]);
-        glEnable(GL_POST_COLOR_MATRIX_COLOR_TABLE);
-    }
-    
-    // Create a texture, upload our image, and bind it (assume a
-    // version of GL that supports NPOT textures)
-    GLuint texture;
-    glGenTextures(1, &texture);
-    glBindTexture(GL_TEXTURE_2D, texture);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, m_imageWidth, m_imageHeight, 0, GL_RGB, GL_FLOAT, &m_imageData[0]);
+    // 8-bit rows need not be 4-byte aligned
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
+    // Create a texture and the buffers that stream our image into it, and
+    // bind it (assume a version of GL that supports NPOT textures and
+    // pixel buffer objects). Rows are exposed and gamma encoded on the
+    // way in with the same table as saved images.
+    m_textureStream.init(m_displayFrame, m_outputGamma);
     glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP);
     glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP);
     glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
@@ -100,12 +133,105 @@ void App::run() {
     glLoadIdentity();
     glOrtho(0, 1, 1, 0, 0, 2);
 
+    // Render on a separate thread so that input never waits for a frame
+    m_asyncRendering = true;
+    m_renderThread = std::thread(&App::renderLoop, this);
+
     // Kick off the timer
     timerCallback(0);
     glutMainLoop();
 }
 
 
+bool App::renderOnWorkers(TileCoordinator& coordinator, int tileSize, int samplesPerPixel) {
+    assert(! m_renderThread.joinable());
+    return coordinator.render(camera(), tileSize, 1, samplesPerPixel, m_framebuffer);
+}
+
+
+App::~App() {
+    if (m_renderThread.joinable()) {
+        m_quit = true;
+        m_renderWake.notify_all();
+        m_renderThread.join();
+    }
+}
+
+
+void App::quit() {
+    if (m_renderThread.joinable()) {
+        m_quit = true;
+        invalidateFrame();
+        m_renderThread.join();
+        m_scheduler.printStatistics(stdout);
+    }
+    ::exit(0);
+}
+
+
+void App::invalidateFrame() {
+    {
+        // Increment under the lock so that a render thread about to wait cannot miss the notification
+        std::lock_guard<std::mutex> lock(m_frameMutex);
+        ++m_inputGeneration;
+    }
+    m_renderWake.notify_all();
+}
+
+
+void App::renderLoop() {
+    while (! m_quit) {
+        const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        m_frameGeneration = m_inputGeneration;
+        m_scheduler.beginFrame(interacting());
+
+        onGraphics();
+
+        const bool cancelled = frameCancelled();
+        m_scheduler.endFrame(std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count(), cancelled);
+        if (cancelled) {
+            // Discard the frame. Its dirty rows stay marked, so they
+            // are uploaded with the next completed frame.
+            continue;
+        }
+        publishFrame();
+
+        // Pace frames like the display timer does, unless input invalidates the scene sooner
+        std::unique_lock<std::mutex> lock(m_frameMutex);
+        const unsigned int generation = m_frameGeneration;
+        m_renderWake.wait_until(lock, start + std::chrono::milliseconds(m_frameTimeMilliseconds), [&] {
+            return m_quit || (m_inputGeneration != generation);
+        });
+    }
+}
+
+
+void App::publishFrame() {
+    std::lock_guard<std::mutex> lock(m_frameMutex);
+
+    int y = 0, count = 0;
+    const bool changed = m_framebuffer.takeDirtyRows(y, count);
+    m_framebuffer.swap(m_readyFrame);
+
+    // m_framebuffer now holds either an old frame whose rows were
+    // already uploaded, or a frame that was never displayed. Rows of
+    // the latter must be uploaded with this one.
+    int skippedY = 0, skippedCount = 0;
+    if (m_framebuffer.takeDirtyRows(skippedY, skippedCount)) {
+        m_readyFrame.markDirty(skippedY, skippedY + skippedCount - 1);
+    }
+    if (changed) {
+        m_readyFrame.markDirty(y, y + count - 1);
+    }
+
+#   ifdef ROOTFINDER_STATS
+        m_readyMarchStepHeatmap = m_marchStepHeatmap;
+#   endif
+
+    m_readyFrameIsNew = true;
+}
+
+
 void App::timerCallback(int value) {
     // Request animation
     glutPostRedisplay();
@@ -123,6 +249,25 @@ void App::staticOnKeyPress(unsigned char key, int x, int y) {
 void App::staticOnMousePress(int button, int state, int x, int y) {
     instance->m_mouseX = x;
     instance->m_mouseY = y;
+
+    if (button == GLUT_LEFT_BUTTON) {
+        if (state == GLUT_DOWN) {
+            instance->m_dragStartX = x;
+            instance->m_dragStartY = y;
+            instance->m_dragStartCamera = instance->camera();
+            instance->m_dragging = true;
+        } else {
+            // Refine the preview right away
+            instance->m_dragging = false;
+            instance->invalidateFrame();
+        }
+    } else if (((button == wheelUpButton) || (button == wheelDownButton)) && (state == GLUT_DOWN)) {
+        Camera c = instance->camera();
+        c.zoom *= (button == wheelUpButton) ? wheelZoomFactor : 1.0f / wheelZoomFactor;
+        instance->m_lastWheelMilliseconds = currentMilliseconds();
+        instance->setCamera(c);
+    }
+
     if (state == GLUT_DOWN) {
         instance->onMousePress(button);
     } else {
@@ -137,6 +282,38 @@ void App::staticOnMouseMotion(int x, int y) {
 }
 
 
+void App::staticOnMouseDrag(int x, int y) {
+    staticOnMouseMotion(x, y);
+    if (instance->m_dragging) {
+        // Horizontal motion orbits around the vertical axis; vertical motion tilts
+        Camera c = instance->m_dragStartCamera;
+        c.yaw   += float(x - instance->m_dragStartX) * dragRadiansPerPixel;
+        c.pitch  = clamp(c.pitch + float(y - instance->m_dragStartY) * dragRadiansPerPixel, -1.5f, 1.5f);
+        instance->setCamera(c);
+    }
+}
+
+
+Camera App::camera() const {
+    std::lock_guard<std::mutex> lock(m_cameraMutex);
+    return m_camera;
+}
+
+
+void App::setCamera(const Camera& camera) {
+    {
+        std::lock_guard<std::mutex> lock(m_cameraMutex);
+        m_camera = camera;
+    }
+    invalidateFrame();
+}
+
+
+bool App::interacting() const {
+    return m_dragging || (currentMilliseconds() - m_lastWheelMilliseconds < wheelInteractionMilliseconds);
+}
+
+
 void App::staticReshape(int width, int height) {
     // Restore the size originally requested
     glutReshapeWindow(int(ceil(float(instance->m_imageWidth)  * instance->m_zoom)), 
@@ -145,16 +322,23 @@ void App::staticReshape(int width, int height) {
 
 
 void App::onKeyPress(unsigned char key) {
-    if (key == 27) { ::exit(0); }
+    if (key == 27) { quit(); }
 }
 
 
 void App::staticOnGraphics() {
-    instance->onGraphics();
+    // Present the latest completed frame, if there is a new one. This
+    // never waits for rendering.
+    {
+        std::lock_guard<std::mutex> lock(instance->m_frameMutex);
+        if (instance->m_readyFrameIsNew) {
+            instance->m_readyFrame.swap(instance->m_displayFrame);
+            instance->m_readyFrameIsNew = false;
+        }
+    }
 
-    // Upload the image
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, instance->m_imageWidth, instance->m_imageHeight, 0,
-                 GL_RGB, GL_FLOAT, &instance->m_imageData[0]);
+    // Upload the rows that changed
+    instance->m_textureStream.upload(instance->m_displayFrame);
 
     // Draw a full-screen quad of the image
     glClear(GL_COLOR_BUFFER_BIT);
@@ -163,80 +347,181 @@ void App::staticOnGraphics() {
 }
 
 
-void App::saveImage(const std::string& filename) {
+bool App::saveMarchStepHeatmap(const std::string& filename) {
+    // While the render thread runs, m_marchStepHeatmap may be half written
+    std::vector<float> heatmap;
+    if (m_renderThread.joinable()) {
+        std::lock_guard<std::mutex> lock(m_frameMutex);
+        heatmap = m_readyMarchStepHeatmap;
+    } else {
+        heatmap = m_marchStepHeatmap;
+    }
+    if (heatmap.empty()) { return false; }
+
+    float maxSteps = 1.0f;
+    for (size_t i = 0; i < heatmap.size(); ++i) {
+        maxSteps = max(maxSteps, heatmap[i]);
+    }
+
+    // "Hot" color ramp: black, red, yellow, white
+    Framebuffer image(m_imageWidth, m_imageHeight, Framebuffer::FLOAT32);
+    for (int y = 0; y < m_imageHeight; ++y) {
+        for (int x = 0; x < m_imageWidth; ++x) {
+            const float t = 3.0f * heatmap[size_t(y) * m_imageWidth + x] / maxSteps;
+            image.set(x, y, Color(clamp(t, 0.0f, 1.0f), clamp(t - 1.0f, 0.0f, 1.0f), clamp(t - 2.0f, 0.0f, 1.0f)));
+        }
+    }
+    return writePNG(filename, image, GammaTable(1.0f, 1.0f));
+}
+
+
+bool App::writeImage(const std::string& filename, const Framebuffer& image) const {
     assert(filename.size() > 4);
-    if (filename.substr(filename.length() - 4) == ".tga") {
-        saveTGA(filename);
-    } else if (filename.substr(filename.length() - 4) == ".ppm") {
-        savePPM(filename);
+    const std::string& extension = filename.substr(filename.length() - 4);
+
+    if (extension == ".tga") {
+        return writeTGA(filename, image, m_outputGamma);
+    } else if (extension == ".ppm") {
+        return writePPM(filename, image, m_outputGamma);
+    } else if (extension == ".png") {
+        return writePNG(filename, image, m_outputGamma);
+    } else if (extension == ".pfm") {
+        return writePFM(filename, image, m_exposureConstant);
     } else {
         // Bad file format
         assert(false);
+        return false;
     }
 }
 
 
-static int PPMGammaCorrect(float v, float e, float g) {
-    return int(pow(std::min(1.0f, std::max(0.0f, v * e)), 1.0f / g) * 255.0f);
-}
+void App::saveImage(const std::string& filename) {
+    // While the render thread runs, m_framebuffer may be half drawn
+    const Framebuffer& image = m_renderThread.joinable() ? m_displayFrame : m_framebuffer;
 
+    if (! writeImage(filename, image)) {
+        fprintf(stderr, "Could not write %s\n", filename.c_str());
+    }
+}
 
-void App::savePPM(const std::string& filename) const {
-    FILE* file = fopen(filename.c_str(), "wt");
-    fprintf(file, "P3 %d %d 255\n", m_imageWidth, m_imageHeight); 
 
-    const float gamma = deviceGamma / m_imageGamma;
+/* Replaces the one %d in pattern, which may have a width and a 0 flag as in
+   "frame%04d.png", with frame, and each %% with %. Returns false if pattern
+   has any other conversion, or not exactly one %d. */
+static bool expandFramePattern(const std::string& pattern, int frame, std::string& name) {
+    name.clear();
+    int conversions = 0;
+    for (size_t i = 0; i < pattern.size(); ++i) {
+        if (pattern[i] != '%') {
+            name += pattern[i];
+            continue;
+        }
+        ++i;
+        if ((i < pattern.size()) && (pattern[i] == '%')) {
+            name += '%';
+            continue;
+        }
+        const bool zeroPad = (i < pattern.size()) && (pattern[i] == '0');
+        int width = 0;
+        while ((i < pattern.size()) && isdigit((unsigned char)pattern[i]) && (width < 100)) {
+            width = 10 * width + (pattern[i] - '0');
+            ++i;
+        }
+        if ((i >= pattern.size()) || (pattern[i] != 'd')) { return false; }
 
-    for (int y = 0, i = 0; y < m_imageHeight; ++y) {
-        fprintf(file, "\n# y = %d\n", y);                                                               
-        for (int x = 0; x < m_imageWidth; ++x, ++i) {
-            const Color& c = m_imageData[i];
-            fprintf(file, "%d %d %d\n", 
-                    PPMGammaCorrect(c.r, m_exposureConstant, gamma), 
-                    PPMGammaCorrect(c.g, m_exposureConstant, gamma),
-                    PPMGammaCorrect(c.b, m_exposureConstant, gamma));
+        const std::string digits = std::to_string(frame);
+        if (int(digits.size()) < width) {
+            name.append(width - digits.size(), zeroPad ? '0' : ' ');
         }
+        name += digits;
+        ++conversions;
     }
-    fclose(file);
-}
-
-
-void App::saveTGA(const std::string& filename) const {
-    // http://www.paulbourke.net/dataformats/tga/
-    FILE* file = fopen(filename.c_str(), "wb");
-
-    // Header
-    putc(0, file);
-    putc(0, file);
-    putc(2, file);                         /* uncompressed RGB */
-    putc(0, file); putc(0, file);
-    putc(0, file); putc(0, file);
-    putc(0, file);
-    putc(0, file); putc(0, file);           /* X origin */
-    putc(0, file); putc(0, file);           /* y origin */
-    printf("%d\n", m_imageWidth); 
-    putc((m_imageWidth & 0x00FF), file);
-    putc((m_imageWidth & 0xFF00) >> 8, file);
-
-    putc((m_imageHeight & 0x00FF), file);
-    putc((m_imageHeight & 0xFF00) >> 8, file);
-
-    putc(24, file);                        /* 32 bit bitmap */
-    putc( (1 << 5), file);                 /* origin = top left */
-
-    const float gamma = deviceGamma / m_imageGamma;
-
-    for (int y = 0, i = 0; y < m_imageHeight; ++y) {
-        for (int x = 0; x < m_imageWidth; ++x, ++i) {
-            const Color& c = m_imageData[i];
-            putc(PPMGammaCorrect(c.b, m_exposureConstant, gamma), file);
-            putc(PPMGammaCorrect(c.g, m_exposureConstant, gamma), file);
-            putc(PPMGammaCorrect(c.r, m_exposureConstant, gamma), file);
-            //putc(0xFF, file); // alpha = 1
+    return conversions == 1;
+}
+
+
+bool App::renderAnimation(const ParameterTrack& track, int frameCount, const std::string& filename) {
+    assert(! m_renderThread.joinable());
+    assert(frameCount > 0);
+
+    const bool video = (filename.size() > 4) && (filename.substr(filename.length() - 4) == ".y4m");
+    Y4MWriter writer(m_outputGamma);
+    if (video && ! writer.open(filename, m_imageWidth, m_imageHeight, int(fps))) { return false; }
+
+    std::string name;
+    if (! video && ! expandFramePattern(filename, 0, name)) {
+        fprintf(stderr, "%s needs exactly one %%d for the frame number\n", filename.c_str());
+        return false;
+    }
+
+    // Frame f renders into slot f % slotCount once frame f - slotCount has been written
+    const int slotCount = 2 * m_threadPool.size();
+    std::vector<Framebuffer> slot(slotCount, Framebuffer(m_imageWidth, m_imageHeight, Framebuffer::FLOAT32));
+    std::vector<bool> ready(slotCount, false);
+
+    std::mutex mutex;
+    std::condition_variable changed;
+    int nextFrame = 0;
+    int written = 0;
+    bool failed = false;
+
+    // Each thread of the pool renders whole frames, so the pixels of one frame are traced serially
+    std::thread renderers([&] {
+        m_threadPool.parallelFor(m_threadPool.size(), [&](int) {
+            std::vector<Color> pixels(size_t(m_imageWidth) * m_imageHeight);
+            while (true) {
+                int f;
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    f = nextFrame++;
+                    if (f >= frameCount) { return; }
+                    changed.wait(lock, [&] { return failed || (f < written + slotCount); });
+                    if (failed) { return; }
+                }
+
+                renderAnimationFrame(track(float(f)), &pixels[0]);
+
+                Framebuffer& frame = slot[f % slotCount];
+                for (int y = 0; y < m_imageHeight; ++y) {
+                    frame.setSpan(0, y, m_imageWidth, &pixels[size_t(y) * m_imageWidth]);
+                }
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    ready[f % slotCount] = true;
+                }
+                changed.notify_all();
+            }
+        });
+    });
+
+    // Write the frames in order as they complete
+    for (int f = 0; f < frameCount; ++f) {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            changed.wait(lock, [&] { return bool(ready[f % slotCount]); });
+        }
+
+        const Framebuffer& frame = slot[f % slotCount];
+        bool ok;
+        if (video) {
+            ok = writer.writeFrame(frame);
+        } else {
+            expandFramePattern(filename, f, name);
+            ok = writeImage(name, frame);
         }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            ready[f % slotCount] = false;
+            ++written;
+            failed = ! ok;
+        }
+        changed.notify_all();
+        if (! ok) { break; }
     }
-    
-    fclose(file);
+
+    renderers.join();
+    return ! failed && writer.close();
 }
 
 ////////////////////////////////////////////////////////////
@@ -272,89 +557,57 @@ void Shape::setRotation(float yaw, float pitch, float roll) {
 
 /////////////////////////////////////////////////////////////
 
-Color App::computeRayCastSample(const Vector2 coord, const Shape& shape, float zoom) {
-    // A small step, used for computing the surface normal
-    // by numerical differentiation. A scaled up version of
-    // this is also used for computing a low-frequency gradient.
-    const float epsilon = minimumDistanceToSurface * 5.0f;
-    
+void App::primaryRay(const Point2 coord, float zoom, Point3& origin, Vector3& direction) const {
     const float cameraDistance = 5.0f;
-    Point3 rayOrigin = Point3(2.0f * coord.x / float(m_imageWidth) - 1.0f, 1.0f - 2.0f * coord.y / float(m_imageHeight), -cameraDistance);
+    origin = Point3(2.0f * coord.x / float(m_imageWidth) - 1.0f, 1.0f - 2.0f * coord.y / float(m_imageHeight), -cameraDistance);
 
     // Correct for aspect ratio
-    rayOrigin.x *= float(m_imageWidth) / float(m_imageHeight);
+    origin.x *= float(m_imageWidth) / float(m_imageHeight);
     
-    const Vector3& rayDirection = normalize(normalize(Point3(0.0f, 0.0f, 1.0f) - rayOrigin) + 
-                                            0.2f * Point3(rayOrigin.x, rayOrigin.y, 0.0f) / zoom);
+    direction = normalize(normalize(Point3(0.0f, 0.0f, 1.0f) - origin) + 
+                          0.2f * Point3(origin.x, origin.y, 0.0f) / zoom);
+}
 
-    
-    // Point on (technically, near) the surface of the shape
-    Point3 X;
-
-    const float t = findSmallestRootOfDistanceFunction(DistanceToShapeOnRay(rayOrigin, rayDirection, shape), 0.0f, 10.0f);
-    const bool hit = ! isnan(t);
-    X = rayOrigin + t * rayDirection;
-
-    Color color;
-    if (hit) {
-        // Compute AO term
-        float d, AO;
-        shape.getDistanceAndShade(X, d, AO);
-        
-        // Back away from the surface a bit before computing the gradient
-        X = X - rayDirection * epsilon;
-        
-        // Accurate micro-normal by numerical derivative
-        Vector3 n = normalize(Vector3(d - shape.distance(X - Vector3(epsilon, 0.0f, 0.0f)),
-                                      d - shape.distance(X - Vector3(0.0f, epsilon, 0.0f)),
-                                      d - shape.distance(X - Vector3(0.0f, 0.0f, epsilon))));
-        
-        // Broad-scale normal to large shape
-        const Vector3& n2 = normalize(Vector3(d - shape.distance(X - Vector3(epsilon * 50.0f, 0.0f, 0.0f)),
-                                              d - shape.distance(X - Vector3(0.0f, epsilon * 50.0f, 0.0f)),
-                                              d - shape.distance(X - Vector3(0.0f, 0.0f, epsilon * 50.0f))));
-
-        // Bend the local surface normal by the
-        // gross local shape normal and the bounding sphere
-        // normal to avoid the hyper-detailed look
-        n = normalize(n + n2 + normalize(X));
-
-        // Fade between the key and fill light based on the normal (Gooch-style wrap shading).
-        // Also darken the surface in cracks (on top of the AO term)
-        return AO * (mix(m_fillLightColor, m_keyLightColor, AO * clamp(0.7f * dot(m_lightDirection, n) + 0.6f, 0.0f, 1.0f)) * surfaceColor(AO) +
-                      // Give the feel of blowing out the highlights with a yellow tint
-                      pow(max(dot(m_lightDirection, n2), 0.0f), 5.0f) * Color(1.3f, 1.2f, 0.0f));
-    } else {
-        // No hit: return the background gradient
-        return mix(m_backgroundGradientCenterColor, m_backgroundGradientRimColor, 
-                   sqrt(length((coord / Vector2(m_imageWidth, m_imageHeight) - Vector2(0.66f, 0.66f)) * 2.5f)));
-    }
+
+RayFootprint App::primaryRayFootprint(const Point2 coord, float zoom, float sampleSpacing, const Point3& origin, const Vector3& direction) const {
+    Point3 neighborOrigin;
+    Vector3 neighborDirection;
+    primaryRay(coord + Vector2(sampleSpacing, 0.0f), zoom, neighborOrigin, neighborDirection);
+    return RayFootprint((neighborOrigin - origin) * 0.5f, (neighborDirection - direction) * 0.5f);
 }
 
 
-Color App::computeRayCastPixel(const Point2 coord, const Shape& function, float zoom) {
-    // 4x rotated-grid SSAA for antialiasing
-    Color color = 
-        //computeRayCastSample(coord, function, zoom);
-        (computeRayCastSample(coord + Vector2(-0.125f, -0.375f), function, zoom) + 
-         computeRayCastSample(coord + Vector2(+0.375f, -0.125f), function, zoom) + 
-         computeRayCastSample(coord + Vector2(+0.125f, +0.375f), function, zoom) +
-         computeRayCastSample(coord + Vector2(-0.375f, +0.125f), function, zoom)) / 4.0f;
+float App::traceRay(const Point3& origin, const Vector3& direction, const RayFootprint& footprint, const Shape& shape, int maxMarchSteps) const {
+    return findSmallestRootOfDistanceFunction(DistanceToShapeOnRay(origin, direction, shape, footprint), 0.0f, 10.0f, footprint, maxMarchSteps);
+}
 
-    
-    // Coarse RGB->sRGB encoding via sqrt
-    color = sqrt(color);
-    
-    // Vignetting (from iq https://www.shadertoy.com/view/MdX3Rr)
-    const Vector2& xy = 2.0f * coord / Vector2(m_imageWidth, m_imageHeight) - Vector2(1.0f, 1.0f);
-    return color * (0.5f + 0.5f * pow((xy.x + 1.0f) * (xy.y + 1.0f) * (xy.x - 1.0f) * (xy.y - 1.0f), 0.2f));
+
+Color App::shadeSurface(const Vector3& microNormal, const Vector3& n2, const Point3& X, float AO) const {
+    // Bend the local surface normal by the
+    // gross local shape normal and the bounding sphere
+    // normal to avoid the hyper-detailed look
+    const Vector3& n = normalize(microNormal + n2 + normalize(X));
+
+    // Fade between the key and fill light based on the normal (Gooch-style wrap shading).
+    // Also darken the surface in cracks (on top of the AO term)
+    return AO * (mix(m_fillLightColor, m_keyLightColor, AO * clamp(0.7f * dot(m_lightDirection, n) + 0.6f, 0.0f, 1.0f)) * surfaceColor(AO) +
+                  // Give the feel of blowing out the highlights with a yellow tint
+                  pow(max(dot(m_lightDirection, n2), 0.0f), 5.0f) * Color(1.3f, 1.2f, 0.0f));
 }
 
 
-void App::drawRayCastImage(const Shape& shape, float zoom) {
-    for (int y = 0; y < m_imageHeight; ++y) {
-        for (int x = 0; x < m_imageWidth; ++x) {
-            setPixel(x, y, computeRayCastPixel(Point2(float(x) + 0.5f, float(y) + 0.5f), shape, zoom));
-        } // x
-    } // y
+Color App::backgroundColor(const Point2 coord) const {
+    return mix(m_backgroundGradientCenterColor, m_backgroundGradientRimColor, 
+               sqrt(length((coord / Vector2(m_imageWidth, m_imageHeight) - Vector2(0.66f, 0.66f)) * 2.5f)));
+}
+
+
+Color App::finishPixel(const Point2 coord, const Color& linear) const {
+    // Coarse RGB->sRGB encoding via sqrt
+    const Color& color = sqrt(linear);
+    
+    // Vignetting from the precomputed tables
+    const int i = max(0, min(int(2.0f * coord.x + 0.5f), 2 * m_imageWidth));
+    const int j = max(0, min(int(2.0f * coord.y + 0.5f), 2 * m_imageHeight));
+    return color * (0.5f + 0.5f * m_vignetteX[i] * m_vignetteY[j]);
 }
@@ -4,9 +4,56 @@
  */
 #ifndef App_h
 #define App_h
+#include <cassert>
 #include <vector>
 #include <string>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
 #include "math3d.h"
+#include "Framebuffer.h"
+#include "TextureStream.h"
+#include "ThreadPool.h"
+#include "Stats.h"
+#include "FrameScheduler.h"
+#include "RootBuffer.h"
+#include "CpuDispatch.h"
+#include "ImageWriter.h"
+
+/** Orientation and magnification of the 3D view. The camera orbits
+    the origin; App applies yaw and pitch by rotating the shape. */
+class Camera {
+public:
+    float yaw;
+    float pitch;
+
+    /* Passed to drawRayCastImage() */
+    float zoom;
+
+    Camera(float yaw = 0.0f, float pitch = 0.0f, float zoom = 1.0f) : yaw(yaw), pitch(pitch), zoom(zoom) {}
+};
+
+
+/** A rectangle of the image, traced with one sample per samplesPerPixel
+    (1 or 4) rays in each pixelSize x pixelSize block, as for drawRayCastImage() */
+class Tile {
+public:
+    int x;
+    int y;
+    int width;
+    int height;
+    int pixelSize;
+    int samplesPerPixel;
+
+    Tile(int x = 0, int y = 0, int width = 0, int height = 0, int pixelSize = 1, int samplesPerPixel = 4) :
+        x(x), y(y), width(width), height(height), pixelSize(pixelSize), samplesPerPixel(samplesPerPixel) {}
+};
+
+
+class TileCoordinator;
+class ParameterTrack;
+class FrameParameters;
 
 /** Subclass this to create your own application */
 class App {
@@ -16,6 +63,14 @@ public:
        Larger numbers lead to faster convergence but "blur" out the shape */
     static const float minimumDistanceToSurface;
 
+    /* Where the ray's footprint is wide, a point within this fraction of its radius of the
+       surface is also considered to be on it. Larger fractions blur low-resolution passes. */
+    static const float SURFACE_FOOTPRINT_FRACTION;
+
+    static float surfaceTolerance(const RayFootprint& footprint, float t) {
+        return max(minimumDistanceToSurface, SURFACE_FOOTPRINT_FRACTION * footprint.radius(t));
+    }
+
 private:
     
     /** For glut callbacks */
@@ -26,6 +81,7 @@ private:
     static void staticOnKeyPress(unsigned char key, int x, int y);
     static void staticOnMousePress(int button, int state, int x, int y);
     static void staticOnMouseMotion(int x, int y);
+    static void staticOnMouseDrag(int x, int y);
     static void staticReshape(int width, int height);
     static void timerCallback(int value);
 
@@ -35,16 +91,97 @@ private:
     const float        m_imageGamma;
     const int          m_frameTimeMilliseconds;
 
-    void savePPM(const std::string& filename) const;
-    void saveTGA(const std::string& filename) const;
+    /** Exposure and gamma for both the display and image files, so that they look the same */
+    const GammaTable   m_outputGamma;
+
+    /* The vignette factors along each axis at half-pixel spacing, so that
+       both pixel centers and block centers hit an entry exactly. The
+       vignette at (x, y) is 0.5 + 0.5 * m_vignetteX[2x] * m_vignetteY[2y]. */
+    std::vector<float> m_vignetteX;
+    std::vector<float> m_vignetteY;
+
+    /** Copies changed rows of m_displayFrame to the displayed texture */
+    TextureStream      m_textureStream;
+
+    /* Frames are triple buffered: the render thread draws into
+       m_framebuffer and swaps it with m_readyFrame when it completes;
+       the display callback swaps m_readyFrame with m_displayFrame when
+       a new frame is ready. Neither thread waits for the other. */
+
+    /** Owned by the glut thread */
+    Framebuffer        m_displayFrame;
+
+    /** The most recently completed frame. Guarded by m_frameMutex. */
+    Framebuffer        m_readyFrame;
+
+    /** True if m_readyFrame has not been displayed yet. Guarded by m_frameMutex. */
+    bool               m_readyFrameIsNew;
+
+    /** m_marchStepHeatmap of m_readyFrame, copied when it is published. Guarded by m_frameMutex. */
+    std::vector<float> m_readyMarchStepHeatmap;
+
+    std::mutex         m_frameMutex;
+
+    /** Wakes the render thread early when the in-flight frame is invalidated or on quit */
+    std::condition_variable m_renderWake;
+
+    std::thread        m_renderThread;
+
+    /** Set by run() before the render thread starts. Frames drawn by calling onGraphics() directly are never cancelled. */
+    bool               m_asyncRendering;
+    std::atomic<bool>  m_quit;
+
+    /** Incremented by invalidateFrame() */
+    std::atomic<unsigned int> m_inputGeneration;
+
+    /** The value of m_inputGeneration when the in-flight frame began. Owned by the render thread. */
+    unsigned int       m_frameGeneration;
+
+    /** Chooses the quality of each frame to meet m_frameTimeMilliseconds. Owned by the render thread. */
+    FrameScheduler     m_scheduler;
+
+    /** Written by the glut thread, read by the render thread. Guarded by m_cameraMutex. */
+    Camera             m_camera;
+    mutable std::mutex m_cameraMutex;
+
+    /** Mouse position and camera when the left button went down */
+    int                m_dragStartX;
+    int                m_dragStartY;
+    Camera             m_dragStartCamera;
+
+    /** True while the left button is held */
+    std::atomic<bool>  m_dragging;
+
+    /** Time of the last wheel event, for interacting() */
+    std::atomic<long long> m_lastWheelMilliseconds;
+
+    /** Body of the render thread: calls onGraphics() and publishes each completed frame */
+    void renderLoop();
+
+    /** Swaps the completed m_framebuffer into m_readyFrame */
+    void publishFrame();
+
+    /** Writes image in the format given by the extension of filename (see saveImage()) */
+    bool writeImage(const std::string& filename, const Framebuffer& image) const;
 
 protected:
 
-    /** Row-major */
-    std::vector<Color> m_imageData;
+    /** The frame that onGraphics() draws. Once run() is called it
+        belongs to the render thread, and completed frames are swapped
+        out to the display. Only rows reported with markDirty() (or
+        written by setSpan() and fillSpan()) are uploaded, so a frame
+        must redraw every row it changes. */
+    Framebuffer        m_framebuffer;
     const int          m_imageWidth;
     const int          m_imageHeight;
 
+    /** For data-parallel rendering work */
+    ThreadPool         m_threadPool;
+
+    /** March steps per pixel of the frame being drawn, summed over its
+        samples. Only filled when compiled with ROOTFINDER_STATS. */
+    std::vector<float> m_marchStepHeatmap;
+
     int                m_mouseX;
     int                m_mouseY;
 
@@ -57,31 +194,143 @@ protected:
     Color              m_backgroundGradientCenterColor;
     Color              m_backgroundGradientRimColor;
 
+    /** Call from an input handler when the input makes the frame
+        being rendered obsolete. The render thread abandons that frame
+        and starts the next one immediately. */
+    void invalidateFrame();
+
+    /** True if invalidateFrame() was called after the current frame
+        began. Long-running onGraphics() code should check this and
+        return early. */
+    bool frameCancelled() const {
+        return m_asyncRendering && (m_inputGeneration.load(std::memory_order_relaxed) != m_frameGeneration);
+    }
+
+    /** Stops the render thread and exits the program */
+    void quit();
+
     /* Shading of the surface as a function of height on [0, 1] */
     virtual Color surfaceColor(float height) const {
         return Color::white();
     }
 
-    /* zoom is the amount to zoom the 3D image, different from m_zoom for 2D scaling of pixels */
-    void drawRayCastImage(const Shape& shape, float zoom);
+    /** Returns a consistent copy of the camera, safe to call from the render thread */
+    Camera camera() const;
+
+    void setCamera(const Camera& camera);
+
+    /** True while the user is dragging or zooming the camera. onGraphics()
+        should render a fast preview (see drawRayCastImage()) while this is
+        true; releasing the mouse invalidates the frame to start the full
+        quality render. */
+    bool interacting() const;
+
+    /** The quality at which onGraphics() should trace the current frame. While
+        interacting() it is the best quality that keeps frames within the frame
+        time; afterwards it rises each frame until full quality. Frames drawn by
+        calling onGraphics() directly are always full quality. */
+    const RenderQuality& frameQuality() const {
+        return m_asyncRendering ? m_scheduler.quality() : m_scheduler.best();
+    }
+
+    /* zoom is the amount to zoom the 3D image, different from m_zoom for 2D scaling of pixels.
+       pixelSize > 1 traces one pixel per pixelSize x pixelSize block, for interactive previews.
+       samplesPerPixel is 1 or 4. maxMarchSteps > 0 abandons rays that have not reached the
+       surface after that many steps, for interactive frames.
 
-    /* Called from drawRayCastImage() for each pixel. Coord should be the center of the pixel. */
-    Color computeRayCastPixel(const Point2 coord, const Shape& shape, float zoom);
+       The renderer is instantiated for the static type of shape. Passing a Shape& marches with
+       findSmallestRootOfDistanceFunction() through virtual calls, which works for any shape.
+       Passing a concrete type whose getDistanceAndShade() is final inlines its distance code
+       into marchToSurface(). */
+    template <class S>
+    void drawRayCastImage(const S& shape, float zoom, int pixelSize = 1, int samplesPerPixel = 4, int maxMarchSteps = 0);
+
+    /* Traces tile like drawRayCastImage() into pixels, which holds tile.width x tile.height
+       colors in rows. Blocks of tile.pixelSize start at the corner of the tile. Rows of blocks
+       run in parallel on m_threadPool. */
+    template <class S>
+    void drawRayCastTile(const S& shape, float zoom, const Tile& tile, Color* pixels);
+
+    /* Traces the row of blocks whose top is image row y into row[0, width), from image column x0
+       on. Each block is quality.pixelSize wide and blockHeight tall, and its color fills its columns
+       of row. With ROOTFINDER_STATS, marchSteps (if not NULL) receives the march steps of each
+       column's block. This is the hot loop of the renderer. */
+    template <class S>
+    void traceBlockRow(const S& shape, float zoom, int x0, int y, int width, int blockHeight, const RenderQuality& quality,
+                       Color* row, float* marchSteps);
+
+    /* traceBlockRow() compiled for isa, which must be supported */
+    template <class S>
+    void traceBlockRow(CpuDispatch::Isa isa, const S& shape, float zoom, int x0, int y, int width, int blockHeight,
+                       const RenderQuality& quality, Color* row, float* marchSteps);
+
+    template <class S> ISA_TARGET_SSE4
+    void traceBlockRowSSE4(const S& shape, float zoom, int x0, int y, int width, int blockHeight, const RenderQuality& quality,
+                           Color* row, float* marchSteps) {
+        traceBlockRow(shape, zoom, x0, y, width, blockHeight, quality, row, marchSteps);
+    }
+
+    template <class S> ISA_TARGET_AVX2
+    void traceBlockRowAVX2(const S& shape, float zoom, int x0, int y, int width, int blockHeight, const RenderQuality& quality,
+                           Color* row, float* marchSteps) {
+        traceBlockRow(shape, zoom, x0, y, width, blockHeight, quality, row, marchSteps);
+    }
+
+    template <class S> ISA_TARGET_AVX512
+    void traceBlockRowAVX512(const S& shape, float zoom, int x0, int y, int width, int blockHeight, const RenderQuality& quality,
+                             Color* row, float* marchSteps) {
+        traceBlockRow(shape, zoom, x0, y, width, blockHeight, quality, row, marchSteps);
+    }
+
+    /* Called from traceBlockRow() for each block. Coord should be the center of the pixel,
+       which is pixelSize image pixels wide. */
+    template <class S>
+    Color computeRayCastPixel(const Point2 coord, const S& shape, float zoom, int samplesPerPixel = 4, int pixelSize = 1, int maxMarchSteps = 0);
 
     /* Called from computeRayCastPixel() for each sample within the pixel. (0.5, 0.5) is the center
-       of the top-left pixel.*/
-    Color computeRayCastSample(const Point2 coord, const Shape& shape, float zoom);
+       of the top-left pixel. Samples are sampleSpacing image pixels apart; the march leaves out
+       shape detail smaller than that. */
+    template <class S>
+    Color computeRayCastSample(const Point2 coord, const S& shape, float zoom, float sampleSpacing = 1.0f, int maxMarchSteps = 0);
+
+    /* Distance along the ray to the surface, or NaN on a miss. Marches with
+       findSmallestRootOfDistanceFunction(), passing on the footprint and step budget. */
+    float traceRay(const Point3& origin, const Vector3& direction, const RayFootprint& footprint, const Shape& shape, int maxMarchSteps = 0) const;
+
+    template <class S>
+    float traceRay(const Point3& origin, const Vector3& direction, const RayFootprint& footprint, const S& shape, int maxMarchSteps = 0) const;
+
+    /** Sphere traces f(x) from xMin and refines the hit by bisection, under the same contract
+        as findSmallestRootOfDistanceFunction(). F is any type with float operator()(float).
+        The surface is found to within minimumDistanceToSurface or SURFACE_FOOTPRINT_FRACTION
+        of footprint.radius(x), whichever is larger. If maxSteps > 0, a march that has not
+        reached the surface after maxSteps evaluations returns NaN. */
+    template <class F>
+    static float marchToSurface(const F& f, float xMin, float xMax, const RayFootprint& footprint = RayFootprint(), int maxSteps = 0);
+
+    /* The parts of computeRayCastSample() that do not depend on the shape */
+    void primaryRay(const Point2 coord, float zoom, Point3& origin, Vector3& direction) const;
+
+    /* Half the distance to the ray sampleSpacing pixels to the right */
+    RayFootprint primaryRayFootprint(const Point2 coord, float zoom, float sampleSpacing, const Point3& origin, const Vector3& direction) const;
+    Color shadeSurface(const Vector3& microNormal, const Vector3& n2, const Point3& X, float AO) const;
+    Color backgroundColor(const Point2 coord) const;
+
+    /* Encodes the averaged samples of the pixel at coord for display */
+    Color finishPixel(const Point2 coord, const Color& linear) const;
 
 public:
 
     /** To obtain typical "2D pixel linear brightness values" use the
         default arguments for exposureConstant and imageGamma. If you want
         your colors on the range [0, 255] instead of [0, 2], set exposureConstant = 1.0f / 255.0f.
+        imageFormat trades precision for memory bandwidth and upload size; see Framebuffer::Format.
     */
     App(const std::string& windowCaption, int imageWidth, int imageHeight, float zoom = 2.0f,
-        float exposureConstant = 1.0f, float imageGamma = 2.1f);
+        float exposureConstant = 1.0f, float imageGamma = 2.1f,
+        Framebuffer::Format imageFormat = Framebuffer::HALF16);
 
-    virtual ~App() {}
+    virtual ~App();
 
     virtual void setPixel(int x, int y, const Color& c) = 0;
 
@@ -99,28 +348,73 @@ public:
     /** Finds all points f(x) = 0 for x in [xMin, xMax] and appends
         them to rootY. Assumes that f(x) is zero for finitely many
         values of x. Uses numerical methods and may miss roots. */
-    virtual void findRoots(const Function& f, float xMin, float xMax, std::vector<float>& root) const {}
+    void findRoots(const Function& f, float xMin, float xMax, std::vector<float>& root) const {
+        RootWorkspace workspace;
+        appendRoots(root, [&](RootBuffer& buffer) { findRoots(f, xMin, xMax, buffer, workspace); });
+    }
+
+    /** As above, but writes the roots to the start of root, which the caller owns, and
+        takes scratch memory from workspace so that no call allocates. If root overflows,
+        root.found() tells how many roots there were. */
+    virtual void findRoots(const Function& f, float xMin, float xMax, RootBuffer& root, RootWorkspace& workspace) const {}
 
     /** Finds the smallest value of x on [xMin, xMax] for which f(x) =
         0, for a conservative distance estimator f(x) in which f(x0) is a conservative
         estimate of the distance along the x-axis from x0 to the root. i.e., all f(y) > 0
-        on y = [x0, x0 + |f(x0)|] if f(x0) > 0.  If there is no root on the interval, returns nan. */
-    virtual float findSmallestRootOfDistanceFunction(const Function& f, float xMin, float xMax) const { return NAN; }
+        on y = [x0, x0 + |f(x0)|] if f(x0) > 0.  If there is no root on the interval, returns nan.
+        The root need only be found to within the surface tolerance of footprint (see
+        marchToSurface()), and if maxSteps > 0, a search that has not found it after maxSteps
+        evaluations may give up and return nan. */
+    virtual float findSmallestRootOfDistanceFunction(const Function& f, float xMin, float xMax, const RayFootprint& footprint = RayFootprint(), int maxSteps = 0) const { return NAN; }
 
-    /** Saves the current image in PPM or TGA format. It must have a
+    /** Saves the most recently displayed frame (or m_framebuffer, if
+        run() has not been called) in binary PPM, run-length encoded
+        TGA, PNG, or floating-point PFM format. It must have a
         lower-case extension. */
     void saveImage(const std::string& filename);
 
+    /** Saves the march step heatmap of the most recently completed frame
+        (or m_marchStepHeatmap, if run() has not been called) as an image,
+        from black (no steps) to white (the most steps in the frame).
+        Returns false if there is no heatmap or the file could not be written. */
+    bool saveMarchStepHeatmap(const std::string& filename);
+
     /** Call this to start the App executing. */
     void run();
 
-    /** Called by App. Override with your image rendering code. */
+    /** Renders the current camera view on the worker processes connected to coordinator
+        instead of calling onGraphics(), for saveImage(). Must be called before run().
+        Returns false if the workers were lost and no others connected in time. */
+    bool renderOnWorkers(TileCoordinator& coordinator, int tileSize = 64, int samplesPerPixel = 4);
+
+    /** Called by TileWorker in worker processes to trace tile as seen by camera into pixels
+        (see drawRayCastTile()). The default draws nothing. */
+    virtual void renderTile(const Camera& camera, const Tile& tile, Color* pixels) {}
+
+    /** Renders frames 0 through frameCount - 1 of track with renderAnimationFrame() and writes
+        them to filename, without opening a window. filename is either a .y4m video or a
+        pattern for an image sequence with one %d for the frame number, which may be
+        padded as in "frame%04d.png"; %% stands for %. Frames render concurrently, one per
+        thread of m_threadPool, while the calling thread writes completed frames in order. At
+        most two frames per thread are held in memory. Must be called before run(). Returns
+        false if the pattern is invalid or a file could not be written. */
+    bool renderAnimation(const ParameterTrack& track, int frameCount, const std::string& filename);
+
+    /** Called by renderAnimation() to trace the whole image for p into pixels, which holds
+        m_imageWidth x m_imageHeight colors in rows. Called from several threads at once, so
+        it must not modify the App; m_threadPool calls made here run serially. The default
+        draws nothing. */
+    virtual void renderAnimationFrame(const FrameParameters& p, Color* pixels) {}
+
+    /** Called by App on the render thread. Override with your image
+        rendering code. Do not make GL calls here. */
     virtual void onGraphics() = 0;
 
     /** The default implementation quits the program when ESC is pressed */
     virtual void onKeyPress(unsigned char keyCode);
 
-    /** Check m_mouseX and m_mouseY for the pixel coordinates.
+    /** Check m_mouseX and m_mouseY for the pixel coordinates. Left
+        dragging and the wheel also drive the camera before these are called.
         The button parameter is one of GLUT_LEFT_BUTTON, GLUT_MIDDLE_BUTTON, or GLUT_RIGHT_BUTTON. 
     */
     virtual void onMouseRelease(int button) {}
@@ -129,4 +423,207 @@ public:
     virtual void onMousePress(int button) {}
 };
 
+template <class S>
+void App::drawRayCastImage(const S& shape, float zoom, int pixelSize, int samplesPerPixel, int maxMarchSteps) {
+    assert(pixelSize >= 1);
+    const RenderQuality quality(pixelSize, samplesPerPixel, maxMarchSteps);
+    const CpuDispatch::Isa isa = CpuDispatch::active();
+    std::vector<Color> row(m_imageWidth);
+    float* marchSteps = NULL;
+#   ifdef ROOTFINDER_STATS
+        m_marchStepHeatmap.resize(size_t(m_imageWidth) * m_imageHeight);
+        std::vector<float> rowSteps(m_imageWidth);
+        marchSteps = &rowSteps[0];
+#   endif
+    for (int y = 0; y < m_imageHeight; y += pixelSize) {
+        if (frameCancelled()) { return; }
+
+        // Trace the center of each pixelSize x pixelSize block and replicate it across the block
+        const int blockHeight = min(pixelSize, m_imageHeight - y);
+        traceBlockRow(isa, shape, zoom, 0, y, m_imageWidth, blockHeight, quality, &row[0], marchSteps);
+
+        for (int i = 0; i < blockHeight; ++i) {
+            m_framebuffer.setSpan(0, y + i, m_imageWidth, &row[0]);
+#           ifdef ROOTFINDER_STATS
+                std::copy(rowSteps.begin(), rowSteps.end(), m_marchStepHeatmap.begin() + size_t(y + i) * m_imageWidth);
+#           endif
+        }
+    } // y
+}
+
+
+template <class S>
+void App::drawRayCastTile(const S& shape, float zoom, const Tile& tile, Color* pixels) {
+    assert(tile.pixelSize >= 1);
+    const RenderQuality quality(tile.pixelSize, tile.samplesPerPixel);
+    const CpuDispatch::Isa isa = CpuDispatch::active();
+    const int rows = (tile.height + tile.pixelSize - 1) / tile.pixelSize;
+    m_threadPool.parallelFor(rows, [&](int r) {
+        const int y = r * tile.pixelSize;
+        const int blockHeight = min(tile.pixelSize, tile.height - y);
+        Color* row = pixels + size_t(y) * tile.width;
+        traceBlockRow(isa, shape, zoom, tile.x, tile.y + y, tile.width, blockHeight, quality, row, (float*)NULL);
+        for (int j = 1; j < blockHeight; ++j) {
+            std::copy(row, row + tile.width, row + size_t(j) * tile.width);
+        }
+    });
+}
+
+
+template <class S>
+void App::traceBlockRow(const S& shape, float zoom, int x0, int y, int width, int blockHeight, const RenderQuality& quality,
+                        Color* row, float* marchSteps) {
+    const int pixelSize = quality.pixelSize;
+    for (int x = 0; x < width; x += pixelSize) {
+        const int blockWidth = min(pixelSize, width - x);
+#       ifdef ROOTFINDER_STATS
+            Stats::local().pixelMarchSteps = 0;
+#       endif
+        const Color& c = computeRayCastPixel(Point2(float(x0 + x) + 0.5f * float(blockWidth), float(y) + 0.5f * float(blockHeight)),
+                                             shape, zoom, quality.samplesPerPixel, pixelSize, quality.maxMarchSteps);
+        for (int i = 0; i < blockWidth; ++i) { row[x + i] = c; }
+#       ifdef ROOTFINDER_STATS
+            if (marchSteps != NULL) {
+                for (int i = 0; i < blockWidth; ++i) { marchSteps[x + i] = float(Stats::local().pixelMarchSteps); }
+            }
+#       endif
+    } // x
+}
+
+
+template <class S>
+void App::traceBlockRow(CpuDispatch::Isa isa, const S& shape, float zoom, int x0, int y, int width, int blockHeight,
+                        const RenderQuality& quality, Color* row, float* marchSteps) {
+    switch (isa) {
+    case CpuDispatch::AVX512:
+        traceBlockRowAVX512(shape, zoom, x0, y, width, blockHeight, quality, row, marchSteps);
+        break;
+    case CpuDispatch::AVX2:
+        traceBlockRowAVX2(shape, zoom, x0, y, width, blockHeight, quality, row, marchSteps);
+        break;
+    case CpuDispatch::SSE4:
+        traceBlockRowSSE4(shape, zoom, x0, y, width, blockHeight, quality, row, marchSteps);
+        break;
+    default:
+        traceBlockRow(shape, zoom, x0, y, width, blockHeight, quality, row, marchSteps);
+    }
+}
+
+
+template <class S>
+Color App::computeRayCastPixel(const Point2 coord, const S& shape, float zoom, int samplesPerPixel, int pixelSize, int maxMarchSteps) {
+    assert((samplesPerPixel == 1) || (samplesPerPixel == 4));
+
+    // 4x rotated-grid SSAA for antialiasing
+    const float spacing = float(pixelSize);
+    const Color& color = (samplesPerPixel == 1) ?
+        computeRayCastSample(coord, shape, zoom, spacing, maxMarchSteps) :
+        (computeRayCastSample(coord + Vector2(-0.125f, -0.375f), shape, zoom, spacing * 0.5f, maxMarchSteps) + 
+         computeRayCastSample(coord + Vector2(+0.375f, -0.125f), shape, zoom, spacing * 0.5f, maxMarchSteps) + 
+         computeRayCastSample(coord + Vector2(+0.125f, +0.375f), shape, zoom, spacing * 0.5f, maxMarchSteps) +
+         computeRayCastSample(coord + Vector2(-0.375f, +0.125f), shape, zoom, spacing * 0.5f, maxMarchSteps)) / 4.0f;
+
+    return finishPixel(coord, color);
+}
+
+
+template <class S>
+Color App::computeRayCastSample(const Point2 coord, const S& shape, float zoom, float sampleSpacing, int maxMarchSteps) {
+    // A small step, used for computing the surface normal
+    // by numerical differentiation. A scaled up version of
+    // this is also used for computing a low-frequency gradient.
+    const float epsilon = minimumDistanceToSurface * 5.0f;
+
+    Point3 rayOrigin;
+    Vector3 rayDirection;
+    primaryRay(coord, zoom, rayOrigin, rayDirection);
+
+    const float t = traceRay(rayOrigin, rayDirection, primaryRayFootprint(coord, zoom, sampleSpacing, rayOrigin, rayDirection), shape, maxMarchSteps);
+    if (std::isnan(t)) {
+        // No hit: return the background gradient
+        return backgroundColor(coord);
+    }
+
+    STATS_TIME(SHADE);
+
+    // Point on (technically, near) the surface of the shape
+    Point3 X = rayOrigin + t * rayDirection;
+
+    // Compute AO term
+    float d, AO;
+    shape.getDistanceAndShade(X, d, AO);
+        
+    // Back away from the surface a bit before computing the gradient
+    X = X - rayDirection * epsilon;
+        
+    // Accurate micro-normal by numerical derivative
+    const Vector3& n = normalize(Vector3(d - distanceToShape(shape, X - Vector3(epsilon, 0.0f, 0.0f)),
+                                         d - distanceToShape(shape, X - Vector3(0.0f, epsilon, 0.0f)),
+                                         d - distanceToShape(shape, X - Vector3(0.0f, 0.0f, epsilon))));
+        
+    // Broad-scale normal to large shape
+    const Vector3& n2 = normalize(Vector3(d - distanceToShape(shape, X - Vector3(epsilon * 50.0f, 0.0f, 0.0f)),
+                                          d - distanceToShape(shape, X - Vector3(0.0f, epsilon * 50.0f, 0.0f)),
+                                          d - distanceToShape(shape, X - Vector3(0.0f, 0.0f, epsilon * 50.0f))));
+
+    return shadeSurface(n, n2, X, AO);
+}
+
+
+template <class S>
+float App::traceRay(const Point3& origin, const Vector3& direction, const RayFootprint& footprint, const S& shape, int maxMarchSteps) const {
+    return marchToSurface(StaticDistanceToShapeOnRay<S>(origin, direction, shape, footprint), 0.0f, 10.0f, footprint, maxMarchSteps);
+}
+
+
+template <class F>
+float App::marchToSurface(const F& f, float xMin, float xMax, const RayFootprint& footprint, int maxSteps) {
+    STATS_COUNT(RAYS);
+    STATS_TIME(MARCH);
+
+    // Minimum step
+    const float inc = 1e-3f;
+
+    // Approach the surface, evaluating once per step
+    float x = xMin;
+    float last = x;
+    float distance = f(x);
+    int steps = 1;
+    while ((distance > surfaceTolerance(footprint, x) - minimumDistanceToSurface) && (x <= xMax) && ((maxSteps <= 0) || (steps < maxSteps))) {
+        last = x;
+        x += max(distance, inc);
+        distance = f(x);
+        ++steps;
+    }
+    STATS_COUNT_N(EVALUATIONS, steps);
+    STATS_RECORD_MARCH(steps);
+
+    // Passed the far end of the ray, or ran out of steps before reaching the surface
+    if ((x > xMax) || (distance > surfaceTolerance(footprint, x) - minimumDistanceToSurface)) { return NAN; }
+
+    // f(last) > 0 >= f(x) on the thickened surface. Bisect until the midpoint is within tolerance of it.
+    STATS_TIME(REFINE);
+    float lo = last;
+    float hi = x;
+    for (int i = 0; i <= 80; ++i) {
+        x = (lo + hi) / 2.0f;
+        distance = f(x);
+        STATS_COUNT(BISECTION_STEPS);
+        STATS_COUNT(EVALUATIONS);
+        if (std::fabs(distance) <= surfaceTolerance(footprint, x)) { break; }
+        if (distance > 0) {
+            lo = x;
+        } else {
+            hi = x;
+        }
+    }
+
+    if (distance < surfaceTolerance(footprint, x)) {
+        STATS_COUNT(RAY_HITS);
+        return x;
+    } else {
+        return NAN;
+    }
+}
+
 #endif
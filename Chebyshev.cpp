@@ -0,0 +1,438 @@
+// Bryan Jones and Melanie Subbiah (2014)
+// All rights reserved
+
+#include <cassert>
+#include <cmath>
+#include <algorithm>
+#include "Chebyshev.h"
+#include "Stats.h"
+
+/* Degrees of the first and second interpolant on each piece. The
+   points of the first are every other point of the second. */
+static const int firstDegree = 16;
+static const int secondDegree = 32;
+
+/* Same threshold as Search::binarySearch */
+static const float zeroThreshold = 0.0003f;
+
+/* Complex roots of a piece's proxy with imaginary part up to this (in
+   [-1, 1] units) may be roots f only touches. A double root of f moves
+   by about the square root of the tolerance when f is approximated. */
+static const double touchingImaginary = 1e-2;
+
+/* Proxy roots this far outside [-1, 1] still belong to the piece */
+static const double edgeSlack = 1e-6;
+
+/* Neighbouring roots are checked for being one root where the proxy is
+   within this many tolerances of zero between them */
+static const double unresolved = 100.0;
+
+/* Newton steps on f for each root */
+static const int polishSteps = 3;
+
+
+/* Chebyshev coefficients of the degree n interpolant through v[j] at
+   t = cos(pi j / n), for j = 0 ... n */
+static void interpolate(const std::vector<double>& v, int n, std::vector<double>& c) {
+    c.assign(n + 1, 0.0);
+    for (int k = 0; k <= n; ++k) {
+        double sum = 0.0;
+        for (int j = 0; j <= n; ++j) {
+            const double w = ((j == 0) || (j == n)) ? 0.5 : 1.0;
+            sum += w * v[j] * cos(M_PI * double(j * k % (2 * n)) / double(n));
+        }
+        c[k] = sum * 2.0 / double(n);
+    }
+    c[0] *= 0.5;
+    c[n] *= 0.5;
+}
+
+
+/* Clenshaw's recurrence for the sum of c[k] T_k(t) */
+static double clenshaw(const std::vector<double>& c, double t) {
+    double b1 = 0.0, b2 = 0.0;
+    for (int k = int(c.size()) - 1; k >= 1; --k) {
+        const double b = 2.0 * t * b1 - b2 + c[k];
+        b2 = b1;
+        b1 = b;
+    }
+    return t * b1 - b2 + c[0];
+}
+
+
+/* Scales rows and columns of the n x n row-major matrix a by powers of
+   two so that they have similar norms, which keeps the eigenvalues of
+   the colleague matrix accurate. Preserves Hessenberg form. */
+static void balance(std::vector<double>& a, int n) {
+    bool done = false;
+    while (! done) {
+        done = true;
+        for (int i = 0; i < n; ++i) {
+            double r = 0.0, c = 0.0;
+            for (int j = 0; j < n; ++j) {
+                if (j != i) {
+                    c += fabs(a[j * n + i]);
+                    r += fabs(a[i * n + j]);
+                }
+            }
+            if ((c == 0.0) || (r == 0.0)) { continue; }
+
+            const double s = c + r;
+            double f = 1.0;
+            while (c < r / 2.0) { f *= 2.0; c *= 4.0; }
+            while (c > r * 2.0) { f /= 2.0; c /= 4.0; }
+            if ((c + r) / f < 0.95 * s) {
+                done = false;
+                for (int j = 0; j < n; ++j) { a[i * n + j] /= f; }
+                for (int j = 0; j < n; ++j) { a[j * n + i] *= f; }
+            }
+        }
+    }
+}
+
+
+/* Eigenvalues re + i im of the n x n row-major upper Hessenberg matrix a
+   by the shifted QR algorithm with Francis double steps. Destroys a.
+   Returns false if an eigenvalue did not converge. */
+static bool hessenbergEigenvalues(std::vector<double>& a, int n, std::vector<double>& re, std::vector<double>& im) {
+#   define A(i, j) a[(i) * n + (j)]
+    re.assign(n, 0.0);
+    im.assign(n, 0.0);
+
+    double norm = 0.0;
+    for (int i = 0; i < n; ++i) {
+        for (int j = max(i - 1, 0); j < n; ++j) { norm += fabs(A(i, j)); }
+    }
+
+    // Eigenvalues nn + 1 ... n - 1 have been found. Shifts are accumulated in t.
+    int nn = n - 1;
+    double t = 0.0;
+    while (nn >= 0) {
+        int iterations = 0;
+        int l;
+        do {
+            // Look for a negligible subdiagonal element to split the matrix at
+            for (l = nn; l >= 1; --l) {
+                double s = fabs(A(l - 1, l - 1)) + fabs(A(l, l));
+                if (s == 0.0) { s = norm; }
+                if (fabs(A(l, l - 1)) + s == s) {
+                    A(l, l - 1) = 0.0;
+                    break;
+                }
+            }
+
+            double x = A(nn, nn);
+            if (l == nn) {
+                // One eigenvalue
+                re[nn] = x + t;
+                im[nn] = 0.0;
+                --nn;
+            } else {
+                double y = A(nn - 1, nn - 1);
+                double w = A(nn, nn - 1) * A(nn - 1, nn);
+                if (l == nn - 1) {
+                    // A 2 x 2 block: two real eigenvalues or a complex pair
+                    const double p = 0.5 * (y - x);
+                    const double q = p * p + w;
+                    double z = sqrt(fabs(q));
+                    x += t;
+                    if (q >= 0.0) {
+                        z = p + ((p >= 0.0) ? z : -z);
+                        re[nn - 1] = re[nn] = x + z;
+                        if (z != 0.0) { re[nn] = x - w / z; }
+                    } else {
+                        re[nn - 1] = re[nn] = x + p;
+                        im[nn - 1] = z;
+                        im[nn] = -z;
+                    }
+                    nn -= 2;
+                } else {
+                    if (iterations == 60) { return false; }
+
+                    if ((iterations == 10) || (iterations == 20)) {
+                        // An exceptional shift, to break cycles
+                        t += x;
+                        for (int i = 0; i <= nn; ++i) { A(i, i) -= x; }
+                        const double s = fabs(A(nn, nn - 1)) + fabs(A(nn - 1, nn - 2));
+                        y = x = 0.75 * s;
+                        w = -0.4375 * s * s;
+                    }
+                    ++iterations;
+
+                    // Find two consecutive small subdiagonal elements to start the double step at
+                    int m;
+                    double p = 0.0, q = 0.0, r = 0.0, z;
+                    for (m = nn - 2; m >= l; --m) {
+                        z = A(m, m);
+                        r = x - z;
+                        double s = y - z;
+                        p = (r * s - w) / A(m + 1, m) + A(m, m + 1);
+                        q = A(m + 1, m + 1) - z - r - s;
+                        r = A(m + 2, m + 1);
+                        s = fabs(p) + fabs(q) + fabs(r);
+                        p /= s;
+                        q /= s;
+                        r /= s;
+                        if (m == l) { break; }
+                        const double u = fabs(A(m, m - 1)) * (fabs(q) + fabs(r));
+                        const double v = fabs(p) * (fabs(A(m - 1, m - 1)) + fabs(z) + fabs(A(m + 1, m + 1)));
+                        if (u + v == v) { break; }
+                    }
+                    for (int i = m + 2; i <= nn; ++i) {
+                        A(i, i - 2) = 0.0;
+                        if (i != m + 2) { A(i, i - 3) = 0.0; }
+                    }
+
+                    // The double step on rows and columns l ... nn
+                    for (int k = m; k <= nn - 1; ++k) {
+                        if (k != m) {
+                            p = A(k, k - 1);
+                            q = A(k + 1, k - 1);
+                            r = (k != nn - 1) ? A(k + 2, k - 1) : 0.0;
+                            x = fabs(p) + fabs(q) + fabs(r);
+                            if (x != 0.0) {
+                                p /= x;
+                                q /= x;
+                                r /= x;
+                            }
+                        }
+                        const double s = (p >= 0.0) ? sqrt(p * p + q * q + r * r) : -sqrt(p * p + q * q + r * r);
+                        if (s == 0.0) { continue; }
+
+                        if (k == m) {
+                            if (l != m) { A(k, k - 1) = -A(k, k - 1); }
+                        } else {
+                            A(k, k - 1) = -s * x;
+                        }
+                        p += s;
+                        x = p / s;
+                        y = q / s;
+                        z = r / s;
+                        q /= p;
+                        r /= p;
+                        for (int j = k; j <= nn; ++j) {
+                            p = A(k, j) + q * A(k + 1, j);
+                            if (k != nn - 1) {
+                                p += r * A(k + 2, j);
+                                A(k + 2, j) -= p * z;
+                            }
+                            A(k + 1, j) -= p * y;
+                            A(k, j) -= p * x;
+                        }
+                        for (int i = l; i <= min(nn, k + 3); ++i) {
+                            p = x * A(i, k) + y * A(i, k + 1);
+                            if (k != nn - 1) {
+                                p += z * A(i, k + 2);
+                                A(i, k + 2) -= p * r;
+                            }
+                            A(i, k + 1) -= p * q;
+                            A(i, k) -= p;
+                        }
+                    }
+                }
+            }
+        } while (l < nn - 1);
+    }
+    return true;
+#   undef A
+}
+
+////////////////////////////////////////////////////////////
+
+ChebyshevProxy::ChebyshevProxy(const Function& f, float xMin, float xMax, double tolerance, int maxDepth) :
+    m_tolerance(tolerance), m_converged(true), m_evaluations(0) {
+
+    assert(xMax > xMin);
+    assert(tolerance > 0);
+    build(f, xMin, xMax, maxDepth);
+}
+
+
+void ChebyshevProxy::build(const Function& f, double a, double b, int depth) {
+    const double mid = 0.5 * (a + b);
+    const double half = 0.5 * (b - a);
+
+    // Samples at the points of the second interpolant; the first uses the even ones
+    std::vector<float> x(secondDegree + 1), y(secondDegree + 1);
+    for (int j = 0; j <= secondDegree; ++j) {
+        x[j] = float(mid + half * cos(M_PI * double(j) / double(secondDegree)));
+    }
+
+    std::vector<double> v, c;
+    Piece piece;
+    piece.a = a;
+    piece.b = b;
+    piece.scale = 0.0;
+
+    bool converged = false;
+    for (int n = firstDegree; n <= secondDegree; n *= 2) {
+        const int stride = secondDegree / n;
+
+        // Evaluate only the points that the previous interpolant did not have, in one batch
+        const int start = (n == firstDegree) ? 0 : stride;
+        const int step = (n == firstDegree) ? stride : 2 * stride;
+        std::vector<float> newX, newY;
+        for (int j = start; j <= secondDegree; j += step) {
+            newX.push_back(x[j]);
+        }
+        newY.resize(newX.size());
+        f.evaluate(&newX[0], &newY[0], int(newX.size()));
+        m_evaluations += int(newX.size());
+        STATS_COUNT_N(EVALUATIONS, int(newX.size()));
+        for (int i = 0; i < int(newY.size()); ++i) {
+            y[start + i * step] = newY[i];
+            piece.scale = std::max(piece.scale, double(fabs(newY[i])));
+        }
+
+        v.resize(n + 1);
+        for (int j = 0; j <= n; ++j) { v[j] = y[j * stride]; }
+        interpolate(v, n, c);
+
+        // The interpolant has converged once its last few coefficients are negligible. Written so that NaN fails.
+        const double bound = m_tolerance * piece.scale;
+        converged = (fabs(c[n]) <= bound) && (fabs(c[n - 1]) <= bound) && (fabs(c[n - 2]) <= bound);
+        if (converged) { break; }
+    }
+
+    if (! converged && (depth > 0)) {
+        build(f, a, mid, depth - 1);
+        build(f, mid, b, depth - 1);
+        return;
+    }
+    m_converged = m_converged && converged;
+
+    // Drop the negligible coefficients, which would only add spurious roots
+    int degree = int(c.size()) - 1;
+    while ((degree > 0) && (fabs(c[degree]) <= m_tolerance * piece.scale)) { --degree; }
+    c.resize(degree + 1);
+    piece.coefficient = c;
+
+    // d[k - 1] = d[k + 1] + 2 k c[k], then halve d[0] and change variables from t to x
+    std::vector<double> d(degree + 2, 0.0);
+    for (int k = degree; k >= 1; --k) {
+        d[k - 1] = d[k + 1] + 2.0 * double(k) * c[k];
+    }
+    d[0] *= 0.5;
+    d.resize(max(degree, 1));
+    for (int k = 0; k < int(d.size()); ++k) { d[k] /= half; }
+    piece.derivative = d;
+
+    m_piece.push_back(piece);
+}
+
+
+const ChebyshevProxy::Piece& ChebyshevProxy::pieceAt(double x) const {
+    int i = 0;
+    while ((i + 1 < int(m_piece.size())) && (x >= m_piece[i + 1].a)) { ++i; }
+    return m_piece[i];
+}
+
+
+double ChebyshevProxy::operator()(double x) const {
+    const Piece& piece = pieceAt(x);
+    return clenshaw(piece.coefficient, (2.0 * x - piece.a - piece.b) / (piece.b - piece.a));
+}
+
+
+double ChebyshevProxy::derivative(double x) const {
+    const Piece& piece = pieceAt(x);
+    return clenshaw(piece.derivative, (2.0 * x - piece.a - piece.b) / (piece.b - piece.a));
+}
+
+
+void ChebyshevProxy::pieceRoots(const Piece& piece, std::vector<double>& t, std::vector<bool>& touching) {
+    t.clear();
+    touching.clear();
+    const std::vector<double>& c = piece.coefficient;
+    const int n = int(c.size()) - 1;
+
+    if (n == 0) {
+        return;
+    } else if (n == 1) {
+        t.push_back(-c[0] / c[1]);
+        touching.push_back(false);
+        return;
+    }
+
+    // The transpose of the colleague matrix, whose eigenvalues are the roots of the
+    // sum of c[k] T_k. It follows from t T_0 = T_1, t T_k = (T_(k-1) + T_(k+1)) / 2,
+    // and T_n = -(c[0] T_0 + ... + c[n-1] T_(n-1)) / c[n]. It is upper Hessenberg.
+    std::vector<double> a(size_t(n) * n, 0.0);
+    a[1 * n + 0] = 1.0;
+    for (int i = 1; i < n - 1; ++i) {
+        a[(i - 1) * n + i] = 0.5;
+        a[(i + 1) * n + i] = 0.5;
+    }
+    a[(n - 2) * n + (n - 1)] += 0.5;
+    for (int k = 0; k < n; ++k) {
+        a[k * n + (n - 1)] -= c[k] / (2.0 * c[n]);
+    }
+
+    balance(a, n);
+    std::vector<double> re, im;
+    if (! hessenbergEigenvalues(a, n, re, im)) { return; }
+
+    for (int i = 0; i < n; ++i) {
+        if ((fabs(im[i]) <= touchingImaginary) && (re[i] >= -1.0 - edgeSlack) && (re[i] <= 1.0 + edgeSlack)) {
+            t.push_back(re[i]);
+            touching.push_back(im[i] != 0.0);
+        }
+    }
+}
+
+
+void ChebyshevProxy::findRoots(const Function& f, std::vector<float>& root) const {
+    std::vector<double> t;
+    std::vector<bool> touching;
+
+    // Polished roots, paired with f there
+    std::vector< std::pair<float, float> > found;
+
+    for (size_t p = 0; p < m_piece.size(); ++p) {
+        const Piece& piece = m_piece[p];
+        pieceRoots(piece, t, touching);
+
+        for (size_t i = 0; i < t.size(); ++i) {
+            const double u = std::max(-1.0, std::min(t[i], 1.0));
+            float x = float(0.5 * (piece.a + piece.b) + 0.5 * (piece.b - piece.a) * u);
+
+            // Newton steps on f, kept only while they reduce |f|
+            float fx = f(x);
+            STATS_COUNT(EVALUATIONS);
+            for (int step = 0; (step < polishSteps) && (fx != 0.0f); ++step) {
+                const double m = derivative(x);
+                if (m == 0.0) { break; }
+                const float next = float(x - fx / m);
+                const float fNext = f(next);
+                STATS_COUNT(EVALUATIONS);
+                if (! (fabs(fNext) < fabs(fx))) { break; }
+                x = next;
+                fx = fNext;
+            }
+
+            if (! touching[i] || (fabs(fx) <= zeroThreshold)) {
+                found.push_back(std::make_pair(x, fx));
+            }
+        }
+    }
+
+    // A root on a piece boundary is found by both pieces, and a root that f
+    // touches may be found as two. Where the proxy is too close to zero
+    // between neighbours to resolve a dip, they are the same root unless
+    // f is farther from zero between them than at them.
+    std::sort(found.begin(), found.end());
+    size_t kept = 0;
+    for (size_t r = 0; r < found.size(); ++r) {
+        if (r > 0) {
+            if (found[r].first == found[kept].first) { continue; }
+            const float mid = 0.5f * (found[kept].first + found[r].first);
+            if (fabs((*this)(mid)) <= unresolved * m_tolerance * pieceAt(mid).scale) {
+                const float fMid = f(mid);
+                STATS_COUNT(EVALUATIONS);
+                if (fabs(fMid) <= max(fabs(found[kept].second), fabs(found[r].second))) { continue; }
+            }
+        }
+        kept = r;
+        root.push_back(found[r].first);
+    }
+}
@@ -0,0 +1,85 @@
+// Bryan Jones and Melanie Subbiah (2014)
+// All rights reserved
+
+#ifndef Chebyshev_h
+#define Chebyshev_h
+
+#include <vector>
+#include "math3d.h"
+
+/** A piecewise Chebyshev interpolant of a smooth Function on an
+    interval, for finding the roots of functions too expensive to scan.
+
+    Each piece samples f at 17 Chebyshev points, then at 33 (reusing the
+    first 17), and is split in half if its trailing coefficients still
+    exceed the tolerance. The roots of a piece are the eigenvalues of its
+    colleague matrix, so roots closer together than any sampling step are
+    found too. */
+class ChebyshevProxy {
+private:
+
+    struct Piece {
+        double              a;
+        double              b;
+
+        /* The largest |f| sampled on the piece */
+        double              scale;
+
+        /* Of T_0 ... T_n mapped to [a, b], without trailing coefficients below the tolerance */
+        std::vector<double> coefficient;
+
+        /* Of the derivative with respect to x */
+        std::vector<double> derivative;
+    };
+
+    /* In increasing order of x, covering the interval */
+    std::vector<Piece>      m_piece;
+
+    /* Relative to Piece::scale */
+    double                  m_tolerance;
+
+    bool                    m_converged;
+    int                     m_evaluations;
+
+    void build(const Function& f, double a, double b, int depth);
+
+    const Piece& pieceAt(double x) const;
+
+    /* Roots of the piece's proxy with t on [-1, 1]. Near-real complex roots are marked in touching. */
+    static void pieceRoots(const Piece& piece, std::vector<double>& t, std::vector<bool>& touching);
+
+public:
+
+    /** tolerance is relative to the largest |f| sampled on each piece.
+        A piece is split at most maxDepth times. */
+    ChebyshevProxy(const Function& f, float xMin, float xMax, double tolerance = 1e-5, int maxDepth = 12);
+
+    /** False if some piece missed the tolerance even at the smallest width,
+        as happens when f is not smooth. The roots are unreliable then. */
+    bool converged() const {
+        return m_converged;
+    }
+
+    /** Evaluations of f made while building the proxy */
+    int evaluations() const {
+        return m_evaluations;
+    }
+
+    int pieceCount() const {
+        return int(m_piece.size());
+    }
+
+    double operator()(double x) const;
+
+    /** The derivative of the proxy */
+    double derivative(double x) const;
+
+    /** Appends the roots of f on the interval in increasing order: the
+        real roots of the proxy, each polished with a few Newton steps on
+        f. Complex roots of the proxy close to the real axis count where f
+        is within the zero threshold, so roots that f only touches are
+        found. Roots that the proxy cannot tell apart are reported once. */
+    void findRoots(const Function& f, std::vector<float>& root) const;
+};
+
+#endif
@@ -0,0 +1,71 @@
+// Bryan Jones and Melanie Subbiah (2014)
+// All rights reserved
+
+#include <string.h>
+#include "CpuDispatch.h"
+
+static const char* isaName[CpuDispatch::NUM_ISAS] = {"generic", "sse4", "avx2", "avx512"};
+
+
+/* Detected on first use. Written only by select() at startup. */
+static CpuDispatch::Isa& activeIsa() {
+    static CpuDispatch::Isa isa = CpuDispatch::detect();
+    return isa;
+}
+
+
+bool CpuDispatch::supported(Isa isa) {
+#   if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+        // These also check that the operating system saves the AVX registers
+        __builtin_cpu_init();
+        switch (isa) {
+        case GENERIC:
+            return true;
+        case SSE4:
+            return __builtin_cpu_supports("sse4.2") && __builtin_cpu_supports("popcnt");
+        case AVX2:
+            return supported(SSE4) && __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma") &&
+                __builtin_cpu_supports("bmi") && __builtin_cpu_supports("bmi2") && __builtin_cpu_supports("f16c");
+        case AVX512:
+            return supported(AVX2) && __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512vl") &&
+                __builtin_cpu_supports("avx512bw") && __builtin_cpu_supports("avx512dq");
+        default:
+            return false;
+        }
+#   else
+        return isa == GENERIC;
+#   endif
+}
+
+
+CpuDispatch::Isa CpuDispatch::detect() {
+    for (int i = NUM_ISAS - 1; i > GENERIC; --i) {
+        if (supported(Isa(i))) { return Isa(i); }
+    }
+    return GENERIC;
+}
+
+
+CpuDispatch::Isa CpuDispatch::active() {
+    return activeIsa();
+}
+
+
+bool CpuDispatch::select(Isa isa) {
+    if (! supported(isa)) { return false; }
+    activeIsa() = isa;
+    return true;
+}
+
+
+bool CpuDispatch::select(const char* name) {
+    for (int i = 0; i < NUM_ISAS; ++i) {
+        if (strcmp(name, isaName[i]) == 0) { return select(Isa(i)); }
+    }
+    return false;
+}
+
+
+const char* CpuDispatch::name(Isa isa) {
+    return ((isa >= 0) && (isa < NUM_ISAS)) ? isaName[isa] : "unknown";
+}
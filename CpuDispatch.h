@@ -0,0 +1,61 @@
+// Bryan Jones and Melanie Subbiah (2014)
+// All rights reserved
+
+#ifndef CpuDispatch_h
+#define CpuDispatch_h
+
+/* Hot kernels are compiled once per instruction set in this one binary.
+   A kernel variant is an ordinary function marked with one of the
+   ISA_TARGET_ macros that calls the portable kernel: the compiler
+   inlines the whole kernel into it and generates code for that
+   instruction set. Callers choose the variant with CpuDispatch::active(),
+   which is fixed once at startup.
+
+   Only GCC and Clang on x86 can compile for other instruction sets;
+   elsewhere every variant is the generic code. */
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#   define ISA_TARGET_SSE4    __attribute__((target("sse4.2,popcnt"), flatten))
+#   define ISA_TARGET_AVX2    __attribute__((target("avx2,fma,bmi,bmi2,f16c,popcnt"), flatten))
+#   define ISA_TARGET_AVX512  __attribute__((target("avx512f,avx512vl,avx512bw,avx512dq,avx2,fma,bmi,bmi2,f16c,popcnt"), flatten))
+#else
+#   define ISA_TARGET_SSE4
+#   define ISA_TARGET_AVX2
+#   define ISA_TARGET_AVX512
+#endif
+
+
+/** Chooses which compiled variant of the hot kernels runs */
+class CpuDispatch {
+public:
+
+    /** In increasing order of capability. Each requires the ones before it. */
+    enum Isa {
+        GENERIC,
+        SSE4,
+        AVX2,
+        AVX512,
+        NUM_ISAS
+    };
+
+    /** True if this processor and operating system can run isa */
+    static bool supported(Isa isa);
+
+    /** The most capable supported isa */
+    static Isa detect();
+
+    /** The variant that kernels should use. detect() unless select() was called. */
+    static Isa active();
+
+    /** Forces a variant, for testing and comparison. Returns false and
+        changes nothing if isa is not supported. Call at startup, before
+        any kernel runs. */
+    static bool select(Isa isa);
+
+    /** select() by name(). Returns false for unknown names. */
+    static bool select(const char* name);
+
+    /** "generic", "sse4", "avx2" or "avx512" */
+    static const char* name(Isa isa);
+};
+
+#endif
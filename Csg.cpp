@@ -0,0 +1,580 @@
+// Bryan Jones and Melanie Subbiah (2014)
+// All rights reserved
+
+#include <cassert>
+#include "Csg.h"
+
+const float CsgProgram::BOUND_MARGIN = 0.5f;
+
+/* Polynomial smooth minimum (http://www.iquilezles.org/www/articles/smin/smin.htm).
+   Blends the shades by the same weight. */
+static void smoothMin(float a, float sa, float b, float sb, float k, float& d, float& s) {
+    const float h = clamp(0.5f + 0.5f * (b - a) / k, 0.0f, 1.0f);
+    d = mix(b, a, h) - k * h * (1.0f - h);
+    s = mix(sb, sa, h);
+}
+
+
+static void smoothMax(float a, float sa, float b, float sb, float k, float& d, float& s) {
+    smoothMin(-a, sa, -b, sb, k, d, s);
+    d = -d;
+}
+
+
+static float sphereDistance(const Point3& P, const float* c) {
+    return length(P) - c[0];
+}
+
+
+/* c = half extents and rounding (http://www.iquilezles.org/www/articles/distfunctions/distfunctions.htm) */
+static float boxDistance(const Point3& P, const float* c) {
+    const Vector3& q = abs(P) - Vector3(c[0], c[1], c[2]);
+    return length(max(q, Vector3(0.0f, 0.0f, 0.0f))) + min(max(q.x, max(q.y, q.z)), 0.0f) - c[3];
+}
+
+
+/* c = major and minor radii. The ring lies in the xz plane. */
+static float torusDistance(const Point3& P, const float* c) {
+    const Vector2 q(length(Vector2(P.x, P.z)) - c[0], P.y);
+    return length(q) - c[1];
+}
+
+
+/* c = the transposed rotation, translation, and scale. Maps a parent point into the child. */
+static Point3 transformPoint(const Point3& P, const float* c) {
+    const Vector3& v = (P - Vector3(c[9], c[10], c[11])) / c[12];
+    return Point3(c[0] * v.x + c[1] * v.y + c[2] * v.z,
+                  c[3] * v.x + c[4] * v.y + c[5] * v.z,
+                  c[6] * v.x + c[7] * v.y + c[8] * v.z);
+}
+
+
+static float repeatCoordinate(float x, float period, float count) {
+    return (period > 0.0f) ? x - period * clamp(floor(x / period + 0.5f), -count, count) : x;
+}
+
+
+/* c = period and count */
+static Point3 repeatPoint(const Point3& P, const float* c) {
+    return Point3(repeatCoordinate(P.x, c[0], c[3]),
+                  repeatCoordinate(P.y, c[1], c[4]),
+                  repeatCoordinate(P.z, c[2], c[5]));
+}
+
+////////////////////////////////////////////////////////////
+
+namespace {
+
+/* Primitives keep their parameters in the layout the interpreter reads */
+class PrimitiveNode : public CsgNode {
+protected:
+    CsgProgram::Opcode  m_op;
+    std::vector<float>  m_parameter;
+    float               m_radius;
+
+public:
+    PrimitiveNode(CsgProgram::Opcode op, const std::vector<float>& parameter, float radius) :
+        m_op(op), m_parameter(parameter), m_radius(radius) {}
+
+    virtual void getDistanceAndShade(const Point3& point, float& distance, float& shade) const override {
+        const float* c = &m_parameter[0];
+        distance = (m_op == CsgProgram::SPHERE) ? sphereDistance(point, c) :
+            (m_op == CsgProgram::BOX) ? boxDistance(point, c) : torusDistance(point, c);
+        shade = 1.0f;
+    }
+
+    virtual BoundingSphere bound() const override {
+        return BoundingSphere(Point3(0.0f, 0.0f, 0.0f), m_radius);
+    }
+
+    virtual int stackDepth() const override {
+        return 1;
+    }
+
+    virtual void compile(CsgProgram& program) const override {
+        int first = 0;
+        for (size_t i = 0; i < m_parameter.size(); ++i) {
+            const int index = program.addConstant(m_parameter[i]);
+            if (i == 0) { first = index; }
+        }
+        program.emit(m_op, first);
+    }
+};
+
+
+class ShapeNode : public CsgNode {
+private:
+    const Shape&    m_shape;
+    float           m_radius;
+
+public:
+    ShapeNode(const Shape& shape, float radius) : m_shape(shape), m_radius(radius) {}
+
+    virtual void getDistanceAndShade(const Point3& point, float& distance, float& shade) const override {
+        m_shape.getDistanceAndShade(point, distance, shade);
+    }
+
+    virtual BoundingSphere bound() const override {
+        return BoundingSphere(Point3(0.0f, 0.0f, 0.0f), m_radius);
+    }
+
+    virtual int stackDepth() const override {
+        return 1;
+    }
+
+    virtual void compile(CsgProgram& program) const override {
+        program.emit(CsgProgram::SHAPE, program.addShape(m_shape));
+    }
+};
+
+
+class BinaryNode : public CsgNode {
+private:
+    CsgProgram::Opcode  m_op;
+    CsgRef              m_a;
+    CsgRef              m_b;
+
+    /* Blend radius for the smooth operations */
+    float               m_k;
+
+    /* Computed once, since nodes are immutable */
+    int                 m_stackDepth;
+
+public:
+    BinaryNode(CsgProgram::Opcode op, const CsgRef& a, const CsgRef& b, float k = 0.0f) : m_op(op), m_a(a), m_b(b), m_k(k) {
+        assert(a && b);
+        assert((k > 0.0f) || (op == CsgProgram::UNION) || (op == CsgProgram::INTERSECTION) || (op == CsgProgram::DIFFERENCE));
+
+        // The deeper child is compiled first (Sethi-Ullman order), and the
+        // other is evaluated with its result on the stack
+        const int da = a->stackDepth();
+        const int db = b->stackDepth();
+        m_stackDepth = (da == db) ? da + 1 : max(da, db);
+    }
+
+    virtual void getDistanceAndShade(const Point3& point, float& distance, float& shade) const override {
+        float a, sa, b, sb;
+        m_a->getDistanceAndShade(point, a, sa);
+        m_b->getDistanceAndShade(point, b, sb);
+        CsgProgram::combine(m_op, a, sa, b, sb, m_k, distance, shade);
+    }
+
+    virtual BoundingSphere bound() const override {
+        const BoundingSphere& a = m_a->bound();
+        const BoundingSphere& b = m_b->bound();
+        switch (m_op) {
+        case CsgProgram::UNION:
+        case CsgProgram::SMOOTH_UNION:
+            {
+                if (! a.bounded() || ! b.bounded()) { return BoundingSphere(); }
+
+                // Smallest sphere enclosing both. The smooth minimum is at
+                // most k / 4 below the minimum, so the blend grows by that much.
+                const float grow = (m_op == CsgProgram::SMOOTH_UNION) ? 0.25f * m_k : 0.0f;
+                const float d = length(b.center - a.center);
+                if (d + b.radius <= a.radius) { return BoundingSphere(a.center, a.radius + grow); }
+                if (d + a.radius <= b.radius) { return BoundingSphere(b.center, b.radius + grow); }
+                const float radius = 0.5f * (d + a.radius + b.radius);
+                return BoundingSphere(a.center + (b.center - a.center) * ((radius - a.radius) / d), radius + grow);
+            }
+
+        case CsgProgram::INTERSECTION:
+        case CsgProgram::SMOOTH_INTERSECTION:
+            // Inside both, so inside the smaller
+            return (a.radius <= b.radius) ? a : b;
+
+        default:
+            // Differences are inside a
+            return a;
+        }
+    }
+
+    virtual int stackDepth() const override {
+        return m_stackDepth;
+    }
+
+    virtual void compile(CsgProgram& program) const override {
+        // Right-nested trees such as long chains of unions then need only two stack entries
+        const bool swapped = m_b->stackDepth() > m_a->stackDepth();
+        program.compileBounded(swapped ? *m_b : *m_a);
+        program.compileBounded(swapped ? *m_a : *m_b);
+        program.emit(m_op, (m_k > 0.0f) ? program.addConstant(m_k) : 0, swapped);
+    }
+};
+
+
+class TransformNode : public CsgNode {
+private:
+    CsgRef      m_child;
+    Matrix3x3   m_rotation;
+    Vector3     m_translation;
+    float       m_scale;
+
+    /* The transposed rotation, translation, and scale, as transformPoint() reads them */
+    float       m_parameter[13];
+
+public:
+    TransformNode(const CsgRef& child, const Matrix3x3& rotation, const Vector3& translation, float scale) :
+        m_child(child), m_rotation(rotation), m_translation(translation), m_scale(scale) {
+        assert(child && (scale > 0.0f));
+        for (int r = 0; r < 3; ++r) {
+            for (int c = 0; c < 3; ++c) {
+                m_parameter[3 * r + c] = rotation.element[c][r];
+            }
+        }
+        m_parameter[9]  = translation.x;
+        m_parameter[10] = translation.y;
+        m_parameter[11] = translation.z;
+        m_parameter[12] = scale;
+    }
+
+    virtual void getDistanceAndShade(const Point3& point, float& distance, float& shade) const override {
+        m_child->getDistanceAndShade(transformPoint(point, m_parameter), distance, shade);
+        distance *= m_scale;
+    }
+
+    virtual BoundingSphere bound() const override {
+        const BoundingSphere& b = m_child->bound();
+        return BoundingSphere(m_translation + m_scale * (m_rotation * b.center), m_scale * b.radius);
+    }
+
+    virtual int stackDepth() const override {
+        return m_child->stackDepth();
+    }
+
+    virtual void compile(CsgProgram& program) const override {
+        int first = 0;
+        for (int i = 0; i < 13; ++i) {
+            const int index = program.addConstant(m_parameter[i]);
+            if (i == 0) { first = index; }
+        }
+        program.emit(CsgProgram::TRANSFORM, first);
+        program.compileBounded(*m_child);
+        program.emit(CsgProgram::END_TRANSFORM, first);
+    }
+};
+
+
+class RepeatNode : public CsgNode {
+private:
+    CsgRef      m_child;
+
+    /* Period and count, as repeatPoint() reads them */
+    float       m_parameter[6];
+
+public:
+    RepeatNode(const CsgRef& child, const Vector3& period, const Vector3& count) : m_child(child) {
+        assert(child && (period.x >= 0.0f) && (period.y >= 0.0f) && (period.z >= 0.0f));
+        m_parameter[0] = period.x;
+        m_parameter[1] = period.y;
+        m_parameter[2] = period.z;
+        m_parameter[3] = count.x;
+        m_parameter[4] = count.y;
+        m_parameter[5] = count.z;
+    }
+
+    virtual void getDistanceAndShade(const Point3& point, float& distance, float& shade) const override {
+        m_child->getDistanceAndShade(repeatPoint(point, m_parameter), distance, shade);
+    }
+
+    virtual BoundingSphere bound() const override {
+        // The copies are symmetric about the child, offset by up to period * count on each repeated axis
+        const Vector3 reach((m_parameter[0] > 0.0f) ? m_parameter[0] * m_parameter[3] : 0.0f,
+                            (m_parameter[1] > 0.0f) ? m_parameter[1] * m_parameter[4] : 0.0f,
+                            (m_parameter[2] > 0.0f) ? m_parameter[2] * m_parameter[5] : 0.0f);
+        const BoundingSphere& b = m_child->bound();
+        return BoundingSphere(b.center, b.radius + length(reach));
+    }
+
+    virtual int stackDepth() const override {
+        return m_child->stackDepth();
+    }
+
+    virtual void compile(CsgProgram& program) const override {
+        int first = 0;
+        for (int i = 0; i < 6; ++i) {
+            const int index = program.addConstant(m_parameter[i]);
+            if (i == 0) { first = index; }
+        }
+        program.emit(CsgProgram::REPEAT, first);
+        program.compileBounded(*m_child);
+        program.emit(CsgProgram::END_REPEAT);
+    }
+};
+
+} // namespace
+
+////////////////////////////////////////////////////////////
+
+CsgRef csgSphere(float radius) {
+    assert(radius > 0.0f);
+    return CsgRef(new PrimitiveNode(CsgProgram::SPHERE, std::vector<float>{radius}, radius));
+}
+
+
+CsgRef csgBox(const Vector3& halfExtent, float rounding) {
+    assert(rounding >= 0.0f);
+    return CsgRef(new PrimitiveNode(CsgProgram::BOX, std::vector<float>{halfExtent.x, halfExtent.y, halfExtent.z, rounding},
+                                    length(halfExtent) + rounding));
+}
+
+
+CsgRef csgTorus(float majorRadius, float minorRadius) {
+    assert((majorRadius > 0.0f) && (minorRadius > 0.0f));
+    return CsgRef(new PrimitiveNode(CsgProgram::TORUS, std::vector<float>{majorRadius, minorRadius}, majorRadius + minorRadius));
+}
+
+
+CsgRef csgShape(const Shape& shape, float radius) {
+    return CsgRef(new ShapeNode(shape, radius));
+}
+
+
+CsgRef csgUnion(const CsgRef& a, const CsgRef& b) {
+    return CsgRef(new BinaryNode(CsgProgram::UNION, a, b));
+}
+
+
+CsgRef csgIntersection(const CsgRef& a, const CsgRef& b) {
+    return CsgRef(new BinaryNode(CsgProgram::INTERSECTION, a, b));
+}
+
+
+CsgRef csgDifference(const CsgRef& a, const CsgRef& b) {
+    return CsgRef(new BinaryNode(CsgProgram::DIFFERENCE, a, b));
+}
+
+
+CsgRef csgSmoothUnion(const CsgRef& a, const CsgRef& b, float k) {
+    return CsgRef(new BinaryNode(CsgProgram::SMOOTH_UNION, a, b, k));
+}
+
+
+CsgRef csgSmoothIntersection(const CsgRef& a, const CsgRef& b, float k) {
+    return CsgRef(new BinaryNode(CsgProgram::SMOOTH_INTERSECTION, a, b, k));
+}
+
+
+CsgRef csgSmoothDifference(const CsgRef& a, const CsgRef& b, float k) {
+    return CsgRef(new BinaryNode(CsgProgram::SMOOTH_DIFFERENCE, a, b, k));
+}
+
+
+CsgRef csgTransform(const CsgRef& child, const Matrix3x3& rotation, const Vector3& translation, float scale) {
+    return CsgRef(new TransformNode(child, rotation, translation, scale));
+}
+
+
+CsgRef csgRepeat(const CsgRef& child, const Vector3& period, const Vector3& count) {
+    return CsgRef(new RepeatNode(child, period, count));
+}
+
+////////////////////////////////////////////////////////////
+
+CsgProgram::CsgProgram(const CsgNode& root) : m_valueDepth(0), m_pointDepth(0), m_maxValueDepth(0), m_maxPointDepth(0) {
+    compileBounded(root);
+    assert(m_valueDepth == 1);
+}
+
+
+int CsgProgram::emit(Opcode op, int operand, bool swapped) {
+    switch (op) {
+    case SPHERE: case BOX: case TORUS: case SHAPE:
+        ++m_valueDepth;
+        break;
+    case UNION: case INTERSECTION: case DIFFERENCE:
+    case SMOOTH_UNION: case SMOOTH_INTERSECTION: case SMOOTH_DIFFERENCE:
+        --m_valueDepth;
+        break;
+    case TRANSFORM: case REPEAT:
+        ++m_pointDepth;
+        break;
+    case END_TRANSFORM: case END_REPEAT:
+        --m_pointDepth;
+        break;
+    case BOUND:
+        // Either way, the subtree that follows leaves one value
+        break;
+    }
+    // A BOUND that skips its subtree pushes one value where the subtree would have
+    m_maxValueDepth = max(m_maxValueDepth, m_valueDepth + ((op == BOUND) ? 1 : 0));
+    m_maxPointDepth = max(m_maxPointDepth, m_pointDepth);
+
+    m_code.push_back(Instruction(op, operand, swapped));
+    return int(m_code.size()) - 1;
+}
+
+
+int CsgProgram::addConstant(float c) {
+    m_constants.push_back(c);
+    return int(m_constants.size()) - 1;
+}
+
+
+int CsgProgram::addShape(const Shape& shape) {
+    m_shapes.push_back(&shape);
+    return int(m_shapes.size()) - 1;
+}
+
+
+void CsgProgram::compileBounded(const CsgNode& node) {
+    const BoundingSphere& b = node.bound();
+    if (! b.bounded()) {
+        node.compile(*this);
+        return;
+    }
+
+    const int check = emit(BOUND);
+    node.compile(*this);
+
+    if (int(m_code.size()) == check + 2) {
+        // A lone primitive costs no more than the check
+        m_code.erase(m_code.begin() + check);
+    } else {
+        m_code[check].operand = addConstant(b.center.x);
+        addConstant(b.center.y);
+        addConstant(b.center.z);
+        addConstant(b.radius);
+        m_code[check].jump = int(m_code.size());
+    }
+}
+
+
+void CsgProgram::combine(Opcode op, float a, float sa, float b, float sb, float k, float& distance, float& shade) {
+    switch (op) {
+    case UNION:
+        distance = min(a, b);
+        shade = (a <= b) ? sa : sb;
+        break;
+    case INTERSECTION:
+        distance = max(a, b);
+        shade = (a >= b) ? sa : sb;
+        break;
+    case DIFFERENCE:
+        distance = max(a, -b);
+        shade = (a >= -b) ? sa : sb;
+        break;
+    case SMOOTH_UNION:
+        smoothMin(a, sa, b, sb, k, distance, shade);
+        break;
+    case SMOOTH_INTERSECTION:
+        smoothMax(a, sa, b, sb, k, distance, shade);
+        break;
+    case SMOOTH_DIFFERENCE:
+        smoothMax(a, sa, -b, sb, k, distance, shade);
+        break;
+    default:
+        assert(false);
+    }
+}
+
+
+void CsgProgram::evaluate(const Point3& point, float& distance, float& shade) const {
+    // The value stack holds distances and shades of evaluated subtrees; the
+    // point stack holds the query point in the space of the current subtree
+    if ((m_maxValueDepth <= MAX_DEPTH) && (m_maxPointDepth < MAX_DEPTH)) {
+        float   d[MAX_DEPTH];
+        float   s[MAX_DEPTH];
+        Point3  p[MAX_DEPTH];
+        run(point, d, s, p, distance, shade);
+    } else {
+        static thread_local std::vector<float>  d, s;
+        static thread_local std::vector<Point3> p;
+        if (int(d.size()) < m_maxValueDepth) {
+            d.resize(m_maxValueDepth);
+            s.resize(m_maxValueDepth);
+        }
+        if (int(p.size()) < m_maxPointDepth + 1) { p.resize(m_maxPointDepth + 1); }
+        run(point, &d[0], &s[0], &p[0], distance, shade);
+    }
+}
+
+
+void CsgProgram::run(const Point3& point, float* d, float* s, Point3* p, float& distance, float& shade) const {
+    int     top = -1;
+    int     pointTop = 0;
+    p[0] = point;
+
+    const Instruction* code = &m_code[0];
+    const float* constant = m_constants.empty() ? NULL : &m_constants[0];
+    const int size = int(m_code.size());
+
+    for (int pc = 0; pc < size; ++pc) {
+        const Instruction& instruction = code[pc];
+        const float* c = constant + instruction.operand;
+        const Point3& P = p[pointTop];
+
+        switch (instruction.op) {
+        case SPHERE:
+            d[++top] = sphereDistance(P, c);
+            s[top] = 1.0f;
+            break;
+
+        case BOX:
+            d[++top] = boxDistance(P, c);
+            s[top] = 1.0f;
+            break;
+
+        case TORUS:
+            d[++top] = torusDistance(P, c);
+            s[top] = 1.0f;
+            break;
+
+        case SHAPE:
+            ++top;
+            m_shapes[instruction.operand]->getDistanceAndShade(P, d[top], s[top]);
+            break;
+
+        case UNION:
+        case INTERSECTION:
+        case DIFFERENCE:
+        case SMOOTH_UNION:
+        case SMOOTH_INTERSECTION:
+        case SMOOTH_DIFFERENCE:
+            {
+                --top;
+                const bool smooth = (instruction.op == SMOOTH_UNION) || (instruction.op == SMOOTH_INTERSECTION) ||
+                    (instruction.op == SMOOTH_DIFFERENCE);
+                const float k = smooth ? c[0] : 0.0f;
+                const int first = instruction.swapped ? top + 1 : top;
+                const int second = instruction.swapped ? top : top + 1;
+                combine(instruction.op, d[first], s[first], d[second], s[second], k, d[top], s[top]);
+            }
+            break;
+
+        case TRANSFORM:
+            p[pointTop + 1] = transformPoint(P, c);
+            ++pointTop;
+            break;
+
+        case END_TRANSFORM:
+            d[top] *= c[12];
+            --pointTop;
+            break;
+
+        case REPEAT:
+            p[pointTop + 1] = repeatPoint(P, c);
+            ++pointTop;
+            break;
+
+        case END_REPEAT:
+            --pointTop;
+            break;
+
+        case BOUND:
+            {
+                const float b = length(P - Point3(c[0], c[1], c[2])) - c[3];
+                if (b > BOUND_MARGIN) {
+                    d[++top] = b;
+                    s[top] = 1.0f;
+                    pc = instruction.jump - 1;
+                }
+            }
+            break;
+        }
+    }
+
+    assert(top == 0);
+    distance = d[0];
+    shade = s[0];
+}
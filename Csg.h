@@ -0,0 +1,186 @@
+// Bryan Jones and Melanie Subbiah (2014)
+// All rights reserved
+
+#ifndef Csg_h
+#define Csg_h
+
+#include <memory>
+#include <vector>
+#include "math3d.h"
+
+class CsgProgram;
+
+/** A sphere enclosing everything within a node's surface. An infinite
+    radius means unbounded. */
+class BoundingSphere {
+public:
+    Point3  center;
+    float   radius;
+
+    BoundingSphere(const Point3& center = Point3(0.0f, 0.0f, 0.0f), float radius = INFINITY) : center(center), radius(radius) {}
+
+    bool bounded() const { return radius < INFINITY; }
+
+    /** A lower bound on the distance from point to anything inside */
+    float distance(const Point3& point) const { return length(point - center) - radius; }
+};
+
+
+/** A node of a constructive solid geometry tree of distance functions.
+    Build trees with the csg*() functions below, and render them by
+    compiling the root into a CsgProgram. Nodes are immutable once built
+    and may be shared between trees. */
+class CsgNode {
+public:
+    virtual ~CsgNode() {}
+
+    /** Evaluates the tree recursively, with one virtual call per node.
+        CsgProgram computes the same values without them. */
+    virtual void getDistanceAndShade(const Point3& point, float& distance, float& shade) const = 0;
+
+    virtual BoundingSphere bound() const = 0;
+
+    /** Entries the compiled node needs on the program's value stack */
+    virtual int stackDepth() const = 0;
+
+    /** Appends the instructions that leave this node's distance and shade on the program's stack */
+    virtual void compile(CsgProgram& program) const = 0;
+};
+
+typedef std::shared_ptr<const CsgNode> CsgRef;
+
+/* Primitives, centered at the origin */
+CsgRef csgSphere(float radius);
+CsgRef csgBox(const Vector3& halfExtent, float rounding = 0.0f);
+CsgRef csgTorus(float majorRadius, float minorRadius);
+
+/** Any other Shape, which must outlive the tree. Evaluated with a virtual
+    call even when compiled. radius bounds the shape about the origin. */
+CsgRef csgShape(const Shape& shape, float radius = INFINITY);
+
+CsgRef csgUnion(const CsgRef& a, const CsgRef& b);
+CsgRef csgIntersection(const CsgRef& a, const CsgRef& b);
+
+/** a with b carved out */
+CsgRef csgDifference(const CsgRef& a, const CsgRef& b);
+
+/* Blends with a fillet of about radius k */
+CsgRef csgSmoothUnion(const CsgRef& a, const CsgRef& b, float k);
+CsgRef csgSmoothIntersection(const CsgRef& a, const CsgRef& b, float k);
+CsgRef csgSmoothDifference(const CsgRef& a, const CsgRef& b, float k);
+
+/** Places child at translation + scale * rotation * x for each point x of the child */
+CsgRef csgTransform(const CsgRef& child, const Matrix3x3& rotation, const Vector3& translation = Vector3(0.0f, 0.0f, 0.0f), float scale = 1.0f);
+
+/** Copies child every period along each axis with a nonzero period, count
+    times in each direction (2 count + 1 copies), or without end if count is
+    infinite. Distances are only exact if the child fits inside one period. */
+CsgRef csgRepeat(const CsgRef& child, const Vector3& period, const Vector3& count = Vector3(INFINITY, INFINITY, INFINITY));
+
+
+/** A CSG tree flattened into linear bytecode for a stack machine. The
+    interpreter is a single switch loop, so evaluating the tree costs no
+    virtual calls except for csgShape() leaves. Subtrees with finite
+    bounds are skipped while the point is more than BOUND_MARGIN outside
+    their bounding sphere, returning the distance to the sphere, which is
+    a conservative estimate. */
+class CsgProgram : public Shape {
+public:
+
+    enum Opcode {
+        /* Push the distance and shade of a primitive. operand indexes its parameters in the constants. */
+        SPHERE, BOX, TORUS,
+
+        /* operand indexes the external shapes */
+        SHAPE,
+
+        /* Combine the top two entries of the stack. The first operand is below
+           the second unless the instruction is swapped. */
+        UNION, INTERSECTION, DIFFERENCE,
+
+        /* operand indexes k in the constants */
+        SMOOTH_UNION, SMOOTH_INTERSECTION, SMOOTH_DIFFERENCE,
+
+        /* Push a point for a subtree. operand indexes the parameters in the constants. */
+        TRANSFORM, REPEAT,
+
+        /* Pop the point pushed by TRANSFORM, scaling the distance back to the
+           parent space. operand is the same as the TRANSFORM's. */
+        END_TRANSFORM,
+
+        /* Pop the point pushed by REPEAT */
+        END_REPEAT,
+
+        /* If the point is far outside the bounding sphere at operand, push the
+           distance to it and jump to the instruction at jump */
+        BOUND
+    };
+
+    struct Instruction {
+        Opcode  op;
+        int     operand;
+        int     jump;
+
+        /* For binary operations: the second operand was computed first, so it is below the first */
+        bool    swapped;
+
+        Instruction(Opcode op, int operand = 0, bool swapped = false) : op(op), operand(operand), jump(0), swapped(swapped) {}
+    };
+
+    static const float BOUND_MARGIN;
+
+    /** Stack depth that the interpreter keeps on the C++ stack. Deeper
+        programs use per-thread storage that grows once. */
+    static const int MAX_DEPTH = 32;
+
+private:
+
+    std::vector<Instruction>    m_code;
+    std::vector<float>          m_constants;
+    std::vector<const Shape*>   m_shapes;
+
+    /* Stack depths after the code emitted so far */
+    int                         m_valueDepth;
+    int                         m_pointDepth;
+
+    /* The deepest the code takes each stack, which sizes the interpreter's stacks */
+    int                         m_maxValueDepth;
+    int                         m_maxPointDepth;
+
+    /* The interpreter, on stacks d and s of m_maxValueDepth entries and p of m_maxPointDepth + 1 */
+    void run(const Point3& point, float* d, float* s, Point3* p, float& distance, float& shade) const;
+
+public:
+
+    /** Compiles root. Shape::setRotation() rotates the whole tree. */
+    explicit CsgProgram(const CsgNode& root);
+
+    /* Called by CsgNode::compile(). emit() returns the index of the instruction
+       and addConstant() the index of c in the constants. */
+    int emit(Opcode op, int operand = 0, bool swapped = false);
+    int addConstant(float c);
+    int addShape(const Shape& shape);
+
+    /** Compiles a child node, preceded by a BOUND check if its bound is
+        finite and its code is longer than one instruction */
+    void compileBounded(const CsgNode& node);
+
+    const std::vector<Instruction>& code() const { return m_code; }
+
+    /** Applies a binary operation to distances and shades a and b. k is the blend radius of the smooth operations. */
+    static void combine(Opcode op, float a, float sa, float b, float sb, float k, float& distance, float& shade);
+
+    /** Runs the program. Allocates nothing unless the program is deeper than MAX_DEPTH. */
+    void evaluate(const Point3& point, float& distance, float& shade) const;
+
+    virtual void getDistanceAndShade(const Point3& point, float& distance, float& shade) const override final {
+        evaluate(rotation * point, distance, shade);
+    }
+
+    /* Evaluated at full detail */
+    virtual void getCoarseDistanceAndShade(const Point3& point, float footprint, float& distance, float& shade) const override final {
+        evaluate(rotation * point, distance, shade);
+    }
+};
+
+#endif
@@ -0,0 +1,103 @@
+// Bryan Jones and Melanie Subbiah (2014)
+// All rights reserved
+
+#include <cassert>
+#include "FrameScheduler.h"
+#include "math3d.h"
+
+/* Step up a level only if it is predicted to take at most this fraction of the deadline */
+static const double headroomFraction = 0.75;
+
+/* Weight of the newest measurement in the running estimate of a level's frame time */
+static const double smoothing = 0.5;
+
+
+FrameScheduler::FrameScheduler(int width, int height, double deadlineMilliseconds) :
+    m_deadlineSeconds(deadlineMilliseconds / 1000.0), m_imageWidth(width), m_imageHeight(height),
+    m_interactiveLevel(0), m_current(-1), m_currentIsInteractive(false) {
+
+    assert(deadlineMilliseconds > 0);
+
+    // Each level does two to four times the work of the one before it
+    m_level.push_back(RenderQuality(8, 1, 32));
+    m_level.push_back(RenderQuality(6, 1, 48));
+    m_level.push_back(RenderQuality(4, 1, 64));
+    m_level.push_back(RenderQuality(3, 1, 64));
+    m_level.push_back(RenderQuality(2, 1, 96));
+    m_level.push_back(RenderQuality(1, 1, 128));
+    m_level.push_back(RenderQuality(1, 4, 0));
+    m_seconds.resize(m_level.size(), 0.0);
+}
+
+
+double FrameScheduler::predictedSeconds(int level) const {
+    if (m_seconds[level] > 0.0) { return m_seconds[level]; }
+
+    // Scale the nearest measured level by the number of rays
+    for (int d = 1; d < int(m_level.size()); ++d) {
+        for (int j = level - d; j <= level + d; j += 2 * d) {
+            if ((j >= 0) && (j < int(m_level.size())) && (m_seconds[j] > 0.0)) {
+                return m_seconds[j] * m_level[level].samples(m_imageWidth, m_imageHeight) / m_level[j].samples(m_imageWidth, m_imageHeight);
+            }
+        }
+    }
+
+    // Nothing measured yet
+    return 0.0;
+}
+
+
+void FrameScheduler::beginFrame(bool interacting) {
+    const int top = int(m_level.size()) - 1;
+    if (interacting) {
+        m_current = m_interactiveLevel;
+    } else if (m_currentIsInteractive || (m_current < 0)) {
+        // The view just settled and the interactive level is on screen. The first frame starts there too.
+        m_current = min(m_interactiveLevel + ((m_current < 0) ? 0 : 1), top);
+    } else {
+        m_current = min(m_current + 1, top);
+    }
+    m_currentIsInteractive = interacting;
+}
+
+
+void FrameScheduler::endFrame(double seconds, bool cancelled) {
+    assert(m_current >= 0);
+    const double milliseconds = seconds * 1000.0;
+    double& estimate = m_seconds[m_current];
+
+    if (cancelled) {
+        // The frame was incomplete, so its time is only a lower bound
+        estimate = max(estimate, (seconds > m_deadlineSeconds) ? seconds : 0.0);
+        if (m_currentIsInteractive) { ++m_statistics.cancelled; }
+    } else {
+        estimate = (estimate > 0.0) ? (smoothing * seconds + (1.0 - smoothing) * estimate) : seconds;
+
+        if (m_currentIsInteractive) {
+            ++m_statistics.frames;
+            m_statistics.totalMilliseconds += milliseconds;
+            m_statistics.maxMilliseconds = max(m_statistics.maxMilliseconds, milliseconds);
+            m_statistics.lastMilliseconds = milliseconds;
+            if (seconds > m_deadlineSeconds) { ++m_statistics.missedDeadlines; }
+        }
+    }
+
+    // Drop to a level that fits right away, but climb one level at a time
+    while ((m_interactiveLevel > 0) && (predictedSeconds(m_interactiveLevel) > m_deadlineSeconds)) {
+        --m_interactiveLevel;
+    }
+    if ((m_interactiveLevel + 1 < int(m_level.size())) &&
+        (predictedSeconds(m_interactiveLevel + 1) <= headroomFraction * m_deadlineSeconds)) {
+        ++m_interactiveLevel;
+    }
+}
+
+
+void FrameScheduler::printStatistics(FILE* file) const {
+    const RenderQuality& q = m_level[m_interactiveLevel];
+    fprintf(file, "Interactive frames: %d (%d over the %.0f ms deadline, %d cancelled), mean %.1f ms, max %.1f ms, last %.1f ms\n",
+            m_statistics.frames, m_statistics.missedDeadlines, m_deadlineSeconds * 1000.0, m_statistics.cancelled,
+            m_statistics.meanMilliseconds(), m_statistics.maxMilliseconds, m_statistics.lastMilliseconds);
+    fprintf(file, "Interactive quality: %dx%d pixels, %d samples per pixel, %d march steps\n",
+            q.pixelSize, q.pixelSize, q.samplesPerPixel, q.maxMarchSteps);
+}
@@ -0,0 +1,115 @@
+// Bryan Jones and Melanie Subbiah (2014)
+// All rights reserved
+
+#ifndef FrameScheduler_h
+#define FrameScheduler_h
+
+#include <stdio.h>
+#include <cassert>
+#include <vector>
+
+/** How finely drawRayCastImage() traces a frame */
+class RenderQuality {
+public:
+    /* One traced pixel per pixelSize x pixelSize block */
+    int pixelSize;
+
+    /* 1 or 4 */
+    int samplesPerPixel;
+
+    /* Sphere tracing steps per ray before it is abandoned as a miss. 0 allows every step. */
+    int maxMarchSteps;
+
+    RenderQuality(int pixelSize = 1, int samplesPerPixel = 4, int maxMarchSteps = 0) :
+        pixelSize(pixelSize), samplesPerPixel(samplesPerPixel), maxMarchSteps(maxMarchSteps) {}
+
+    /** Rays traced for a width x height image */
+    double samples(int width, int height) const {
+        return double((width + pixelSize - 1) / pixelSize) * double((height + pixelSize - 1) / pixelSize) * samplesPerPixel;
+    }
+};
+
+
+/** Chooses the RenderQuality of each interactive frame so that frames finish within a
+    deadline. It keeps a running estimate of the time each quality level takes; levels
+    not yet measured are predicted from the nearest measured one by their sample counts.
+    While the view changes, frames use the best level predicted to fit the deadline,
+    stepping down as soon as a frame misses it and back up when there is headroom. Once
+    the view is still, each frame is traced one level finer until full quality. */
+class FrameScheduler {
+public:
+
+    /** Times of the frames drawn while the view was changing */
+    class Statistics {
+    public:
+        int     frames;
+        int     missedDeadlines;
+        double  totalMilliseconds;
+        double  maxMilliseconds;
+        double  lastMilliseconds;
+
+        /* Frames abandoned for newer input before they completed */
+        int     cancelled;
+
+        Statistics() : frames(0), missedDeadlines(0), totalMilliseconds(0), maxMilliseconds(0), lastMilliseconds(0), cancelled(0) {}
+
+        double meanMilliseconds() const {
+            return (frames > 0) ? totalMilliseconds / frames : 0.0;
+        }
+    };
+
+private:
+
+    /* From coarsest to full quality */
+    std::vector<RenderQuality>  m_level;
+
+    /* Smoothed seconds per frame at each level, or 0 if not measured yet */
+    std::vector<double>         m_seconds;
+
+    const double                m_deadlineSeconds;
+    const int                   m_imageWidth;
+    const int                   m_imageHeight;
+
+    /* The best level that fits the deadline */
+    int                         m_interactiveLevel;
+
+    /* The level of the frame in progress, or -1 before the first */
+    int                         m_current;
+    bool                        m_currentIsInteractive;
+
+    Statistics                  m_statistics;
+
+    double predictedSeconds(int level) const;
+
+public:
+
+    /** Frames of a width x height image should take at most deadlineMilliseconds */
+    FrameScheduler(int width, int height, double deadlineMilliseconds);
+
+    /** Chooses the quality of the next frame. While interacting the deadline applies;
+        otherwise the quality rises one level per frame. */
+    void beginFrame(bool interacting);
+
+    /** Reports the time that the frame begun by beginFrame() took. A cancelled frame
+        is only counted if it had already run past the deadline. */
+    void endFrame(double seconds, bool cancelled);
+
+    /** The quality chosen by the last beginFrame() */
+    const RenderQuality& quality() const {
+        assert(m_current >= 0);
+        return m_level[m_current];
+    }
+
+    /** Full quality, for frames drawn without a deadline */
+    const RenderQuality& best() const {
+        return m_level.back();
+    }
+
+    const Statistics& statistics() const {
+        return m_statistics;
+    }
+
+    void printStatistics(FILE* file) const;
+};
+
+#endif
@@ -0,0 +1,44 @@
+// Bryan Jones and Melanie Subbiah (2014)
+// All rights reserved
+
+#include <cassert>
+#include "Framebuffer.h"
+
+Framebuffer::Framebuffer(int width, int height, Format format, float quantizationScale) :
+    m_format(format), m_width(width), m_height(height),
+    m_scale(quantizationScale), m_invScale(1.0f / quantizationScale),
+    m_dirtyBegin(0), m_dirtyEnd(height) {
+
+    assert((width > 0) && (height > 0));
+    assert(quantizationScale > 0);
+
+    const size_t n = size_t(width) * height;
+    switch (m_format) {
+    case FLOAT32:
+        for (int c = 0; c < 3; ++c) { m_plane[c].resize(n); }
+        break;
+    case HALF16:
+        m_half.resize(n * 3);
+        break;
+    case SRGB8:
+        m_byte.resize(n * 3);
+        break;
+    }
+}
+
+
+void Framebuffer::clear(const Color& c) {
+    for (int y = 0; y < m_height; ++y) {
+        fillSpan(0, y, m_width, c);
+    }
+}
+
+
+void Framebuffer::swap(Framebuffer& other) {
+    assert((m_width == other.m_width) && (m_height == other.m_height) && (m_format == other.m_format));
+    for (int c = 0; c < 3; ++c) { m_plane[c].swap(other.m_plane[c]); }
+    m_half.swap(other.m_half);
+    m_byte.swap(other.m_byte);
+    std::swap(m_dirtyBegin, other.m_dirtyBegin);
+    std::swap(m_dirtyEnd, other.m_dirtyEnd);
+}
@@ -0,0 +1,225 @@
+// Bryan Jones and Melanie Subbiah (2014)
+// All rights reserved
+
+#ifndef Framebuffer_h
+#define Framebuffer_h
+
+#include <vector>
+#include <string.h>
+#include <stdint.h>
+#include "math3d.h"
+
+/* IEEE 754 binary16 conversion, rounding to nearest even. Overflow saturates to infinity. */
+inline uint16_t floatToHalf(float f) {
+    uint32_t bits;
+    memcpy(&bits, &f, sizeof(bits));
+    const uint32_t sign = (bits >> 16) & 0x8000;
+    const uint32_t magnitude = bits & 0x7FFFFFFF;
+
+    if (magnitude >= 0x7F800000) {
+        // Inf or NaN
+        return uint16_t(sign | 0x7C00 | ((magnitude > 0x7F800000) ? 0x200 : 0));
+    } else if (magnitude >= 0x477FF000) {
+        // Rounds to a value too large for a half
+        return uint16_t(sign | 0x7C00);
+    } else if (magnitude < 0x38800000) {
+        // Denormal half (or zero): shift the mantissa with its implicit bit into place
+        if (magnitude < 0x33000000) { return uint16_t(sign); }
+        const uint32_t exponent = magnitude >> 23;
+        const uint32_t mantissa = (magnitude & 0x7FFFFF) | 0x800000;
+        const uint32_t shift = 126 - exponent;
+        const uint32_t half = mantissa >> shift;
+        const uint32_t remainder = mantissa & ((1u << shift) - 1);
+        const uint32_t midpoint = 1u << (shift - 1);
+        return uint16_t(sign | (half + ((remainder > midpoint) || ((remainder == midpoint) && (half & 1)))));
+    } else {
+        // Normal: rebias the exponent and round away the low 13 mantissa bits
+        const uint32_t half = (magnitude - 0x38000000) >> 13;
+        const uint32_t remainder = magnitude & 0x1FFF;
+        return uint16_t(sign | (half + ((remainder > 0x1000) || ((remainder == 0x1000) && (half & 1)))));
+    }
+}
+
+
+inline float halfToFloat(uint16_t h) {
+    const uint32_t sign = uint32_t(h & 0x8000) << 16;
+    const uint32_t exponent = (h >> 10) & 0x1F;
+    uint32_t mantissa = h & 0x3FF;
+    uint32_t bits;
+
+    if (exponent == 0x1F) {
+        bits = sign | 0x7F800000 | (mantissa << 13);
+    } else if (exponent != 0) {
+        bits = sign | ((exponent + 112) << 23) | (mantissa << 13);
+    } else if (mantissa == 0) {
+        bits = sign;
+    } else {
+        // Denormal half: normalize it
+        uint32_t e = 113;
+        while ((mantissa & 0x400) == 0) { mantissa <<= 1; --e; }
+        bits = sign | (e << 23) | ((mantissa & 0x3FF) << 13);
+    }
+
+    float f;
+    memcpy(&f, &bits, sizeof(f));
+    return f;
+}
+
+
+/** An RGB image stored in one of several formats. All accessors are
+    non-virtual and inlined so that rasterizers can write pixels in
+    tight loops. Row 0 is the top of the image. */
+class Framebuffer {
+public:
+
+    enum Format {
+        /** Separate planes of 32-bit floats for r, g, and b (structure of arrays) */
+        FLOAT32,
+
+        /** Interleaved RGB half floats. Keeps HDR values at half the size of FLOAT32. */
+        HALF16,
+
+        /** Interleaved RGB bytes. Values are multiplied by the quantization
+            scale and clamped to [0, 1]. The renderer writes display-encoded
+            (sRGB-like) values, so 8 bits are enough for display. */
+        SRGB8
+    };
+
+private:
+
+    Format                      m_format;
+    int                         m_width;
+    int                         m_height;
+
+    /* Used by SRGB8 */
+    float                       m_scale;
+    float                       m_invScale;
+
+    /* Rows [m_dirtyBegin, m_dirtyEnd) have changed since the last takeDirtyRows() */
+    int                         m_dirtyBegin;
+    int                         m_dirtyEnd;
+
+    /* Only the storage for m_format is allocated */
+    std::vector<float>          m_plane[3];
+    std::vector<uint16_t>       m_half;
+    std::vector<unsigned char>  m_byte;
+
+    static unsigned char quantize(float v) {
+        // Written so that NaN maps to zero
+        return (v > 0.0f) ? ((v < 1.0f) ? (unsigned char)(v * 255.0f + 0.5f) : 255) : 0;
+    }
+
+public:
+
+    /** quantizationScale multiplies values stored in SRGB8 format and is ignored by the others */
+    Framebuffer(int width, int height, Format format = FLOAT32, float quantizationScale = 1.0f);
+
+    int width() const { return m_width; }
+    int height() const { return m_height; }
+    Format format() const { return m_format; }
+
+    bool inBounds(int x, int y) const {
+        return (unsigned int)x < (unsigned int)m_width && (unsigned int)y < (unsigned int)m_height;
+    }
+
+    /** No bounds checking */
+    void set(int x, int y, const Color& c) {
+        const size_t i = size_t(y) * m_width + x;
+        switch (m_format) {
+        case FLOAT32:
+            m_plane[0][i] = c.r;
+            m_plane[1][i] = c.g;
+            m_plane[2][i] = c.b;
+            break;
+        case HALF16:
+            encode(c, &m_half[3 * i]);
+            break;
+        case SRGB8:
+            encode(c, &m_byte[3 * i]);
+            break;
+        }
+    }
+
+    /** Stores c in rgb as set() does in HALF16 format, so that a color
+        written to many pixels through halfRow() is converted once */
+    static void encode(const Color& c, uint16_t* rgb) {
+        rgb[0] = floatToHalf(c.r);
+        rgb[1] = floatToHalf(c.g);
+        rgb[2] = floatToHalf(c.b);
+    }
+
+    /** Stores c in rgb as set() does in SRGB8 format */
+    void encode(const Color& c, unsigned char* rgb) const {
+        rgb[0] = quantize(c.r * m_scale);
+        rgb[1] = quantize(c.g * m_scale);
+        rgb[2] = quantize(c.b * m_scale);
+    }
+
+    /** No bounds checking */
+    Color get(int x, int y) const {
+        const size_t i = size_t(y) * m_width + x;
+        switch (m_format) {
+        case FLOAT32:
+            return Color(m_plane[0][i], m_plane[1][i], m_plane[2][i]);
+        case HALF16:
+            return Color(halfToFloat(m_half[3 * i]), halfToFloat(m_half[3 * i + 1]), halfToFloat(m_half[3 * i + 2]));
+        default:
+            return Color(m_byte[3 * i], m_byte[3 * i + 1], m_byte[3 * i + 2]) * (m_invScale / 255.0f);
+        }
+    }
+
+    /** Records that rows y0 through y1 (inclusive) changed. set() does
+        not do this, so callers that write single pixels report the rows
+        they touched. The span writers report their own rows. */
+    void markDirty(int y0, int y1) {
+        m_dirtyBegin = min(m_dirtyBegin, max(y0, 0));
+        m_dirtyEnd = max(m_dirtyEnd, min(y1 + 1, m_height));
+    }
+
+    /** Returns false if nothing changed. Otherwise stores the changed
+        rows in [y0, y0 + count) and resets the dirty region. */
+    bool takeDirtyRows(int& y0, int& count) {
+        if (m_dirtyBegin >= m_dirtyEnd) { return false; }
+        y0 = m_dirtyBegin;
+        count = m_dirtyEnd - m_dirtyBegin;
+        m_dirtyBegin = m_height;
+        m_dirtyEnd = 0;
+        return true;
+    }
+
+    /** Writes count pixels from src starting at (x, y). No bounds checking. */
+    void setSpan(int x, int y, int count, const Color* src) {
+        for (int i = 0; i < count; ++i) { set(x + i, y, src[i]); }
+        markDirty(y, y);
+    }
+
+    /** Fills count pixels starting at (x, y) with c. No bounds checking. */
+    void fillSpan(int x, int y, int count, const Color& c) {
+        for (int i = 0; i < count; ++i) { set(x + i, y, c); }
+        markDirty(y, y);
+    }
+
+    /** Decodes row y to floating point */
+    void getRow(int y, Color* dst) const {
+        for (int x = 0; x < m_width; ++x) { dst[x] = get(x, y); }
+    }
+
+    /** Row y of plane channel (0 = r, 1 = g, 2 = b). FLOAT32 only. */
+    float* planeRow(int channel, int y) { return &m_plane[channel][size_t(y) * m_width]; }
+    const float* planeRow(int channel, int y) const { return &m_plane[channel][size_t(y) * m_width]; }
+
+    /** Interleaved RGB row y. HALF16 only. */
+    uint16_t* halfRow(int y) { return &m_half[size_t(y) * m_width * 3]; }
+    const uint16_t* halfRow(int y) const { return &m_half[size_t(y) * m_width * 3]; }
+
+    /** Interleaved RGB row y. SRGB8 only. */
+    unsigned char* byteRow(int y) { return &m_byte[size_t(y) * m_width * 3]; }
+    const unsigned char* byteRow(int y) const { return &m_byte[size_t(y) * m_width * 3]; }
+
+    void clear(const Color& c = Color::black());
+
+    /** Exchanges contents and dirty rows with other, which must have the same dimensions and format. Constant time. */
+    void swap(Framebuffer& other);
+};
+
+#endif
@@ -0,0 +1,342 @@
+// Bryan Jones and Melanie Subbiah (2014)
+// All rights reserved
+
+#include <stdio.h>
+#include <string.h>
+#include <cassert>
+#include <vector>
+#include <zlib.h>
+#include "ImageWriter.h"
+#include "Framebuffer.h"
+#include "CpuDispatch.h"
+
+GammaTable::GammaTable(float exposure, float gamma) : m_scale(exposure * float(SIZE)) {
+    assert(gamma > 0);
+    for (int i = 0; i <= SIZE; ++i) {
+        m_table[i] = (unsigned char)(pow(float(i) / float(SIZE), 1.0f / gamma) * 255.0f + 0.5f);
+    }
+}
+
+
+void GammaTable::encodeRGB(const Color* src, int width, unsigned char* dst) const {
+    for (int x = 0; x < width; ++x, dst += 3) {
+        dst[0] = (*this)(src[x].r);
+        dst[1] = (*this)(src[x].g);
+        dst[2] = (*this)(src[x].b);
+    }
+}
+
+
+void GammaTable::encodeBGR(const Color* src, int width, unsigned char* dst) const {
+    for (int x = 0; x < width; ++x, dst += 3) {
+        dst[0] = (*this)(src[x].b);
+        dst[1] = (*this)(src[x].g);
+        dst[2] = (*this)(src[x].r);
+    }
+}
+
+////////////////////////////////////////////////////////////
+
+static bool writeFile(const std::string& filename, const std::vector<unsigned char>& data) {
+    FILE* file = fopen(filename.c_str(), "wb");
+    if (file == NULL) { return false; }
+    const bool ok = (fwrite(&data[0], 1, data.size(), file) == data.size());
+    return (fclose(file) == 0) && ok;
+}
+
+
+static void appendString(std::vector<unsigned char>& data, const char* s) {
+    data.insert(data.end(), s, s + strlen(s));
+}
+
+
+static void appendBigEndian32(std::vector<unsigned char>& data, unsigned int v) {
+    data.push_back((v >> 24) & 0xFF);
+    data.push_back((v >> 16) & 0xFF);
+    data.push_back((v >> 8) & 0xFF);
+    data.push_back(v & 0xFF);
+}
+
+
+bool writePPM(const std::string& filename, const Framebuffer& image, const GammaTable& gamma) {
+    const int width = image.width();
+    const int height = image.height();
+    std::vector<Color> pixels(width);
+
+    char header[64];
+    snprintf(header, sizeof(header), "P6\n%d %d\n255\n", width, height);
+
+    std::vector<unsigned char> data;
+    appendString(data, header);
+    const size_t start = data.size();
+    data.resize(start + size_t(width) * height * 3);
+
+    for (int y = 0; y < height; ++y) {
+        image.getRow(y, &pixels[0]);
+        gamma.encodeRGB(&pixels[0], width, &data[start + size_t(y) * width * 3]);
+    }
+    return writeFile(filename, data);
+}
+
+
+bool writeTGA(const std::string& filename, const Framebuffer& image, const GammaTable& gamma) {
+    const int width = image.width();
+    const int height = image.height();
+    std::vector<Color> pixels(width);
+
+    // http://www.paulbourke.net/dataformats/tga/
+    const unsigned char header[18] = {
+        0, 0,
+        10,                                 /* run-length encoded RGB */
+        0, 0, 0, 0, 0,
+        0, 0,                               /* X origin */
+        0, 0,                               /* Y origin */
+        (unsigned char)(width & 0x00FF), (unsigned char)((width & 0xFF00) >> 8),
+        (unsigned char)(height & 0x00FF), (unsigned char)((height & 0xFF00) >> 8),
+        24,                                 /* 24 bit bitmap */
+        (1 << 5)                            /* origin = top left */
+    };
+
+    std::vector<unsigned char> data(header, header + sizeof(header));
+
+    // Worst case is one extra packet header per 128 pixels
+    data.reserve(data.size() + size_t(width) * height * 3 + size_t(height) * (width / 128 + 1));
+
+    std::vector<unsigned char> row(width * 3);
+
+    for (int y = 0; y < height; ++y) {
+        image.getRow(y, &pixels[0]);
+        gamma.encodeBGR(&pixels[0], width, &row[0]);
+
+        // Packets never cross scanlines and hold at most 128 pixels
+        int x = 0;
+        while (x < width) {
+            const unsigned char* p = &row[x * 3];
+
+            // Length of the run of pixels identical to p
+            int run = 1;
+            while ((x + run < width) && (run < 128) && (memcmp(p, p + run * 3, 3) == 0)) { ++run; }
+
+            if (run > 1) {
+                data.push_back(0x80 | (run - 1));
+                data.insert(data.end(), p, p + 3);
+                x += run;
+            } else {
+                // Raw packet: extend until the next run of two or more begins
+                int count = 1;
+                while ((x + count < width) && (count < 128) &&
+                       ! ((x + count + 1 < width) && (memcmp(p + count * 3, p + (count + 1) * 3, 3) == 0))) {
+                    ++count;
+                }
+                data.push_back(count - 1);
+                data.insert(data.end(), p, p + count * 3);
+                x += count;
+            }
+        }
+    }
+    return writeFile(filename, data);
+}
+
+
+static void appendPNGChunk(std::vector<unsigned char>& data, const char* type, const unsigned char* chunk, size_t length) {
+    appendBigEndian32(data, (unsigned int)length);
+    const size_t start = data.size();
+    data.insert(data.end(), type, type + 4);
+    if (length > 0) { data.insert(data.end(), chunk, chunk + length); }
+
+    // The CRC covers the type and the contents
+    appendBigEndian32(data, (unsigned int)crc32(0L, &data[start], (uInt)(length + 4)));
+}
+
+
+bool writePNG(const std::string& filename, const Framebuffer& image, const GammaTable& gamma) {
+    const int width = image.width();
+    const int height = image.height();
+    std::vector<Color> pixels(width);
+
+    // http://www.libpng.org/pub/png/spec/1.2/PNG-Contents.html
+    static const unsigned char signature[8] = {137, 'P', 'N', 'G', 13, 10, 26, 10};
+
+    // Each scanline is a filter type byte followed by the RGB bytes.
+    // The "Sub" filter stores each byte minus the byte of the pixel to
+    // its left, which compresses smooth gradients well for little cost.
+    const size_t stride = size_t(width) * 3 + 1;
+    std::vector<unsigned char> raw(stride * height);
+    std::vector<unsigned char> row(width * 3);
+    for (int y = 0; y < height; ++y) {
+        unsigned char* dst = &raw[stride * y];
+        image.getRow(y, &pixels[0]);
+        gamma.encodeRGB(&pixels[0], width, &row[0]);
+        dst[0] = 1;
+        for (int i = 0; i < 3; ++i) { dst[1 + i] = row[i]; }
+        for (int i = 3; i < width * 3; ++i) { dst[1 + i] = (unsigned char)(row[i] - row[i - 3]); }
+    }
+
+    uLongf compressedSize = compressBound(uLong(raw.size()));
+    std::vector<unsigned char> compressed(compressedSize);
+    if (compress2(&compressed[0], &compressedSize, &raw[0], uLong(raw.size()), Z_BEST_SPEED) != Z_OK) {
+        return false;
+    }
+
+    std::vector<unsigned char> ihdr;
+    appendBigEndian32(ihdr, width);
+    appendBigEndian32(ihdr, height);
+    ihdr.push_back(8);                     /* bits per channel */
+    ihdr.push_back(2);                     /* truecolor RGB */
+    ihdr.push_back(0);                     /* deflate */
+    ihdr.push_back(0);                     /* adaptive filtering */
+    ihdr.push_back(0);                     /* not interlaced */
+
+    std::vector<unsigned char> data(signature, signature + sizeof(signature));
+    data.reserve(data.size() + compressedSize + 64);
+    appendPNGChunk(data, "IHDR", &ihdr[0], ihdr.size());
+    appendPNGChunk(data, "IDAT", &compressed[0], compressedSize);
+    appendPNGChunk(data, "IEND", NULL, 0);
+    return writeFile(filename, data);
+}
+
+
+bool writePFM(const std::string& filename, const Framebuffer& image, float exposure) {
+    const int width = image.width();
+    const int height = image.height();
+    std::vector<Color> pixels(width);
+
+    // http://www.pauldebevec.com/Research/HDR/PFM/
+    // A negative scale marks little-endian data. Rows are stored bottom to top.
+    char header[64];
+    snprintf(header, sizeof(header), "PF\n%d %d\n-1.0\n", width, height);
+
+    std::vector<unsigned char> data;
+    appendString(data, header);
+    const size_t start = data.size();
+    data.resize(start + size_t(width) * height * 3 * sizeof(float));
+
+    // The header length is arbitrary, so assemble each row separately and copy it into place
+    std::vector<float> row(size_t(width) * 3);
+    unsigned char* dst = &data[start];
+    for (int y = height - 1; y >= 0; --y, dst += row.size() * sizeof(float)) {
+        image.getRow(y, &pixels[0]);
+        const Color* src = &pixels[0];
+        for (int x = 0; x < width; ++x) {
+            row[3 * x]     = src[x].r * exposure;
+            row[3 * x + 1] = src[x].g * exposure;
+            row[3 * x + 2] = src[x].b * exposure;
+        }
+        memcpy(dst, &row[0], row.size() * sizeof(float));
+    }
+
+    // PFM is little-endian; swap on big-endian hosts
+    const unsigned int one = 1;
+    if (*reinterpret_cast<const unsigned char*>(&one) == 0) {
+        for (size_t i = start; i < data.size(); i += 4) {
+            std::swap(data[i], data[i + 3]);
+            std::swap(data[i + 1], data[i + 2]);
+        }
+    }
+    return writeFile(filename, data);
+}
+
+
+Y4MWriter::Y4MWriter(const GammaTable& gamma) : m_file(NULL), m_gamma(gamma), m_width(0), m_height(0) {}
+
+
+Y4MWriter::~Y4MWriter() {
+    close();
+}
+
+
+bool Y4MWriter::open(const std::string& filename, int width, int height, int framesPerSecond) {
+    assert(m_file == NULL);
+    assert((width > 0) && (height > 0) && (framesPerSecond > 0));
+    m_file = fopen(filename.c_str(), "wb");
+    if (m_file == NULL) { return false; }
+
+    m_width = width;
+    m_height = height;
+    m_row.resize(width);
+    m_rgb.resize(size_t(width) * height * 3);
+
+    // One luma plane and two quarter-size chroma planes. Odd sizes round the chroma planes up.
+    const size_t chroma = size_t((width + 1) / 2) * ((height + 1) / 2);
+    m_yuv.resize(size_t(width) * height + 2 * chroma);
+
+    // http://wiki.multimedia.cx/index.php?title=YUV4MPEG2
+    return fprintf(m_file, "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C420jpeg XYSCSS=420JPEG XCOLORRANGE=FULL\n",
+                   width, height, framesPerSecond) > 0;
+}
+
+
+/* Converts interleaved 8-bit RGB to full-range BT.601 4:2:0 planes */
+static void rgbToYUV420(const unsigned char* rgb, int width, int height, unsigned char* yuv) {
+    unsigned char* luma = yuv;
+    for (size_t i = 0; i < size_t(width) * height; ++i) {
+        const unsigned char* p = &rgb[3 * i];
+        luma[i] = (unsigned char)(0.299f * p[0] + 0.587f * p[1] + 0.114f * p[2] + 0.5f);
+    }
+
+    // Each chroma sample averages a 2x2 block of pixels, clipped at the edges
+    const int chromaWidth = (width + 1) / 2;
+    const int chromaHeight = (height + 1) / 2;
+    unsigned char* cb = luma + size_t(width) * height;
+    unsigned char* cr = cb + size_t(chromaWidth) * chromaHeight;
+    for (int cy = 0; cy < chromaHeight; ++cy) {
+        for (int cx = 0; cx < chromaWidth; ++cx) {
+            float r = 0.0f, g = 0.0f, b = 0.0f;
+            int count = 0;
+            for (int y = 2 * cy; y < min(2 * cy + 2, height); ++y) {
+                for (int x = 2 * cx; x < min(2 * cx + 2, width); ++x, ++count) {
+                    const unsigned char* p = &rgb[(size_t(y) * width + x) * 3];
+                    r += p[0];
+                    g += p[1];
+                    b += p[2];
+                }
+            }
+            r /= float(count);
+            g /= float(count);
+            b /= float(count);
+            const size_t i = size_t(cy) * chromaWidth + cx;
+            cb[i] = (unsigned char)clamp(128.0f - 0.168736f * r - 0.331264f * g + 0.5f * b + 0.5f, 0.0f, 255.0f);
+            cr[i] = (unsigned char)clamp(128.0f + 0.5f * r - 0.418688f * g - 0.081312f * b + 0.5f, 0.0f, 255.0f);
+        }
+    }
+}
+
+ISA_TARGET_SSE4 static void rgbToYUV420SSE4(const unsigned char* rgb, int width, int height, unsigned char* yuv) {
+    rgbToYUV420(rgb, width, height, yuv);
+}
+
+ISA_TARGET_AVX2 static void rgbToYUV420AVX2(const unsigned char* rgb, int width, int height, unsigned char* yuv) {
+    rgbToYUV420(rgb, width, height, yuv);
+}
+
+ISA_TARGET_AVX512 static void rgbToYUV420AVX512(const unsigned char* rgb, int width, int height, unsigned char* yuv) {
+    rgbToYUV420(rgb, width, height, yuv);
+}
+
+
+bool Y4MWriter::writeFrame(const Framebuffer& frame) {
+    assert(m_file != NULL);
+    assert((frame.width() == m_width) && (frame.height() == m_height));
+
+    for (int y = 0; y < m_height; ++y) {
+        frame.getRow(y, &m_row[0]);
+        m_gamma.encodeRGB(&m_row[0], m_width, &m_rgb[size_t(y) * m_width * 3]);
+    }
+
+    switch (CpuDispatch::active()) {
+    case CpuDispatch::AVX512: rgbToYUV420AVX512(&m_rgb[0], m_width, m_height, &m_yuv[0]); break;
+    case CpuDispatch::AVX2:   rgbToYUV420AVX2(&m_rgb[0], m_width, m_height, &m_yuv[0]); break;
+    case CpuDispatch::SSE4:   rgbToYUV420SSE4(&m_rgb[0], m_width, m_height, &m_yuv[0]); break;
+    default:                  rgbToYUV420(&m_rgb[0], m_width, m_height, &m_yuv[0]);
+    }
+
+    return (fputs("FRAME\n", m_file) >= 0) && (fwrite(&m_yuv[0], 1, m_yuv.size(), m_file) == m_yuv.size());
+}
+
+
+bool Y4MWriter::close() {
+    if (m_file == NULL) { return true; }
+    const bool ok = (fclose(m_file) == 0);
+    m_file = NULL;
+    return ok;
+}
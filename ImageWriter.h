@@ -0,0 +1,98 @@
+// Bryan Jones and Melanie Subbiah (2014)
+// All rights reserved
+
+#ifndef ImageWriter_h
+#define ImageWriter_h
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include "math3d.h"
+
+class Framebuffer;
+
+/** Maps linear channel values to 8-bit gamma-encoded values through a
+    precomputed table, so that encoding an image costs no pow() calls. */
+class GammaTable {
+private:
+
+    /* Number of table intervals on [0, 1] */
+    static const int   SIZE = 4096;
+
+    unsigned char      m_table[SIZE + 1];
+
+    /* exposure * SIZE */
+    float              m_scale;
+
+public:
+
+    /** Values are multiplied by exposure, clamped to [0, 1], and raised to 1 / gamma. */
+    GammaTable(float exposure, float gamma);
+
+    unsigned char operator()(float v) const {
+        const float s = v * m_scale;
+        // Written so that NaN maps to black
+        if (! (s > 0.0f)) { return m_table[0]; }
+        if (s >= float(SIZE)) { return m_table[SIZE]; }
+        return m_table[int(s + 0.5f)];
+    }
+
+    /** Encodes width pixels to interleaved 8-bit RGB */
+    void encodeRGB(const Color* src, int width, unsigned char* dst) const;
+
+    /** Encodes width pixels to interleaved 8-bit BGR (the TGA channel order) */
+    void encodeBGR(const Color* src, int width, unsigned char* dst) const;
+};
+
+
+/* Each writer encodes the whole file in memory and writes it with a
+   single fwrite. They return false if the file could not be written. */
+
+/** Binary (P6) PPM */
+bool writePPM(const std::string& filename, const Framebuffer& image, const GammaTable& gamma);
+
+/** Run-length encoded 24-bit TGA */
+bool writeTGA(const std::string& filename, const Framebuffer& image, const GammaTable& gamma);
+
+/** 24-bit PNG, compressed with zlib */
+bool writePNG(const std::string& filename, const Framebuffer& image, const GammaTable& gamma);
+
+/** Linear floating-point PFM for HDR output. Values are scaled by exposure but not gamma encoded. */
+bool writePFM(const std::string& filename, const Framebuffer& image, float exposure);
+
+
+/** Streams frames to a YUV4MPEG2 (.y4m) video, which ffmpeg and most
+    players read. Unlike the image writers, each frame is written as soon
+    as it is given, so a long sequence never has to fit in memory. Frames
+    are stored as full-range 4:2:0 YCbCr (JPEG's BT.601 matrix). */
+class Y4MWriter {
+private:
+
+    FILE*                       m_file;
+    GammaTable                  m_gamma;
+    int                         m_width;
+    int                         m_height;
+
+    /* Scratch space for one frame */
+    std::vector<Color>          m_row;
+    std::vector<unsigned char>  m_rgb;
+    std::vector<unsigned char>  m_yuv;
+
+public:
+
+    explicit Y4MWriter(const GammaTable& gamma);
+
+    /** Closes the file if it is open */
+    ~Y4MWriter();
+
+    /** Creates filename and writes the stream header. Returns false on failure. */
+    bool open(const std::string& filename, int width, int height, int framesPerSecond);
+
+    /** Appends frame, which must have the size given to open(). Returns false on failure. */
+    bool writeFrame(const Framebuffer& frame);
+
+    /** Returns false if any buffered data could not be written */
+    bool close();
+};
+
+#endif
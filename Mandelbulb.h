@@ -4,6 +4,259 @@
 #define Mandelbulb_h
 
 #include "math3d.h"
+#include "App.h"
+#include "CpuDispatch.h"
+
+// The distance functions are implemented in the header and their
+// getDistanceAndShade() and getCoarseDistanceAndShade() methods are final,
+// so that App::drawRayCastImage() can inline them into the ray march when
+// given a concrete shape type.
+
+/* x^N by repeated squaring, unrolled at compile time */
+template <int N, bool ODD = (N % 2 == 1)>
+struct IntegerPower {
+    static float of(float x) {
+        const float h = IntegerPower<N / 2>::of(x);
+        return h * h;
+    }
+};
+
+template <int N>
+struct IntegerPower<N, true> {
+    static float of(float x) { return IntegerPower<N - 1>::of(x) * x; }
+};
+
+template <>
+struct IntegerPower<0, false> {
+    static float of(float x) { return 1.0f; }
+};
+
+
+/* (re + i im)^N by repeated squaring, unrolled at compile time */
+template <int N, bool ODD = (N % 2 == 1)>
+struct ComplexPower {
+    static void of(float re, float im, float& outRe, float& outIm) {
+        float hRe, hIm;
+        ComplexPower<N / 2>::of(re, im, hRe, hIm);
+        outRe = hRe * hRe - hIm * hIm;
+        outIm = 2.0f * hRe * hIm;
+    }
+};
+
+template <int N>
+struct ComplexPower<N, true> {
+    static void of(float re, float im, float& outRe, float& outIm) {
+        float pRe, pIm;
+        ComplexPower<N - 1>::of(re, im, pRe, pIm);
+        outRe = pRe * re - pIm * im;
+        outIm = pRe * im + pIm * re;
+    }
+};
+
+template <>
+struct ComplexPower<0, false> {
+    static void of(float re, float im, float& outRe, float& outIm) {
+        outRe = 1.0f;
+        outIm = 0.0f;
+    }
+};
+
+
+/* The "spherical power" Q^n that the Mandelbulb iterates, for any real n:
+   the polar angles of Q are multiplied by n and its length is raised to n. */
+class RealSphericalPower {
+private:
+    float n;
+
+public:
+    explicit RealSphericalPower(float n) : n(n) {}
+
+    float power() const { return n; }
+
+    /* Sets Qn = Q^n and returns r^(n - 1), where r = length(Q) > 0 */
+    float operator()(const Point3& Q, float r, Point3& Qn) const {
+        // Convert to polar coordinates and then rotate by the power
+        const float theta = acos(Q.z / r) * n;
+        const float phi   = atan2(Q.y, Q.x) * n;
+        const float rn1   = pow(r, n - 1.0f);
+
+        // Convert back to Cartesian coordinates
+        const float sinTheta = sin(theta);
+        Qn = Vector3(sinTheta * cos(phi),
+                     sinTheta * sin(phi),
+                     cos(theta)) * (rn1 * r);
+        return rn1;
+    }
+};
+
+
+/* The spherical power for integer N without trigonometry. With rho = sqrt(x^2 + y^2),
+   the polar angles of Q satisfy cos(theta) + i sin(theta) = (z + i rho) / r and
+   cos(phi) + i sin(phi) = (x + i y) / rho, so by de Moivre's formula multiplying
+   the angles by N raises those unit complex numbers to the Nth power. */
+template <int N>
+class IntegerSphericalPower {
+public:
+
+    float power() const { return float(N); }
+
+    float operator()(const Point3& Q, float r, Point3& Qn) const {
+        const float rho = sqrt(Q.x * Q.x + Q.y * Q.y);
+
+        float cosNTheta, sinNTheta;
+        ComplexPower<N>::of(Q.z / r, rho / r, cosNTheta, sinNTheta);
+
+        // On the z axis, phi = atan2(0, 0) = 0
+        float cosNPhi = 1.0f, sinNPhi = 0.0f;
+        if (rho > 0.0f) {
+            ComplexPower<N>::of(Q.x / rho, Q.y / rho, cosNPhi, sinNPhi);
+        }
+
+        const float rn1 = IntegerPower<N - 1>::of(r);
+        const float rn  = rn1 * r;
+        Qn = Vector3(sinNTheta * cosNPhi,
+                     sinNTheta * sinNPhi,
+                     cosNTheta) * rn;
+        return rn1;
+    }
+};
+
+
+/* Distance estimate for the Mandelbulb whose iteration uses spherical,
+   a RealSphericalPower or IntegerSphericalPower. Iteration stops early
+   once the detail that remains is smaller than footprint (see
+   Shape::getCoarseDistanceAndShade()); 0 allows every iteration. */
+template <class SphericalPower>
+inline void mandelbulbDistanceAndShade(const Matrix3x3& rotation, const SphericalPower& spherical, const Point3& point, float footprint,
+                                       float& distance, float& shade) {
+    // Rotate the query point into the reference frame of the function
+    // 3x3 matrix-vector product
+    const Point3& P = rotation * point;
+    shade = 1.0f;
+
+    // This is a 3D analog of the 2D Mandelbrot set. Altering the mandlebulbExponent
+    // affects the shape.
+    // See the equation at
+    // http://blog.hvidtfeldts.net/index.php/2011/09/distance-estimated-3d-fractals-v-the-mandelbulb-different-de-approximations/
+    Point3 Q = P;
+
+    // Put the whole shape in a bounding sphere to
+    // speed up distant ray marching. This is necessary
+    // to ensure that we don't expend all ray march iterations
+    // before even approaching the surface
+    {
+        const float externalBoundingRadius = 1.2f;
+        distance = length(P) - externalBoundingRadius;
+        // If we're more than 1 unit away from the
+        // surface, return that distance
+        if (distance > 1.0f) { return; }
+    }
+
+    // Used to smooth discrete iterations into continuous distance field
+    // (similar to the trick used for coloring the Mandelbrot set)
+    float derivative = 1.0f;
+
+    // Higher is more complex and fills holes
+    const int ITERATIONS = 18;
+
+    for (int i = 0; i < ITERATIONS; ++i) {
+        // Darken as we go deeper
+        shade *= 0.725f;
+        const float r = length(Q);
+
+        if (r > 2.0f) {
+            // The point escaped. Remap shade for more brightness and return
+            shade = min((shade + 0.075f) * 4.1f, 1.0f);
+
+            // Bias slightly so that our root finder can identify a true zero
+            distance = 0.5f * log(r) * r / derivative - 0.001f;
+            return;
+        } else {
+            Point3 Qn;
+            const float rn1 = spherical(Q, r, Qn);
+
+            // Update the derivative
+            derivative = rn1 * spherical.power() * derivative + 1.0f;
+
+            // Offset by the original point (which we're orbiting)
+            Q = Qn + P;
+
+            // Later iterations only move the surface on the scale of 1 / derivative.
+            // Once that is within the footprint, estimate the distance from the orbit so far.
+            if (footprint * derivative > 1.0f) {
+                const float rq = length(Q);
+                const float estimate = 0.5f * log(rq) * rq / derivative - 0.001f;
+                distance = (estimate > 0.0f) ? estimate : 0.0f;
+                return;
+            }
+        }
+    }
+
+    // Never escaped, so either already in the set...or a complete miss
+    distance = App::minimumDistanceToSurface;
+}
+
+
+typedef void (*MandelbulbKernel)(const Matrix3x3& rotation, float power, const Point3& point, float footprint, float& distance, float& shade);
+
+inline void realPowerMandelbulb(const Matrix3x3& rotation, float power, const Point3& point, float footprint, float& distance, float& shade) {
+    mandelbulbDistanceAndShade(rotation, RealSphericalPower(power), point, footprint, distance, shade);
+}
+
+template <int N>
+inline void integerPowerMandelbulb(const Matrix3x3& rotation, float power, const Point3& point, float footprint, float& distance, float& shade) {
+    mandelbulbDistanceAndShade(rotation, IntegerSphericalPower<N>(), point, footprint, distance, shade);
+}
+
+
+/* The kernels above compiled for each CpuDispatch::Isa */
+ISA_TARGET_SSE4 inline void realPowerMandelbulbSSE4(const Matrix3x3& rotation, float power, const Point3& point, float footprint, float& distance, float& shade) {
+    realPowerMandelbulb(rotation, power, point, footprint, distance, shade);
+}
+
+ISA_TARGET_AVX2 inline void realPowerMandelbulbAVX2(const Matrix3x3& rotation, float power, const Point3& point, float footprint, float& distance, float& shade) {
+    realPowerMandelbulb(rotation, power, point, footprint, distance, shade);
+}
+
+ISA_TARGET_AVX512 inline void realPowerMandelbulbAVX512(const Matrix3x3& rotation, float power, const Point3& point, float footprint, float& distance, float& shade) {
+    realPowerMandelbulb(rotation, power, point, footprint, distance, shade);
+}
+
+template <int N> ISA_TARGET_SSE4
+inline void integerPowerMandelbulbSSE4(const Matrix3x3& rotation, float power, const Point3& point, float footprint, float& distance, float& shade) {
+    integerPowerMandelbulb<N>(rotation, power, point, footprint, distance, shade);
+}
+
+template <int N> ISA_TARGET_AVX2
+inline void integerPowerMandelbulbAVX2(const Matrix3x3& rotation, float power, const Point3& point, float footprint, float& distance, float& shade) {
+    integerPowerMandelbulb<N>(rotation, power, point, footprint, distance, shade);
+}
+
+template <int N> ISA_TARGET_AVX512
+inline void integerPowerMandelbulbAVX512(const Matrix3x3& rotation, float power, const Point3& point, float footprint, float& distance, float& shade) {
+    integerPowerMandelbulb<N>(rotation, power, point, footprint, distance, shade);
+}
+
+
+inline MandelbulbKernel realPowerKernel(CpuDispatch::Isa isa) {
+    switch (isa) {
+    case CpuDispatch::AVX512: return realPowerMandelbulbAVX512;
+    case CpuDispatch::AVX2:   return realPowerMandelbulbAVX2;
+    case CpuDispatch::SSE4:   return realPowerMandelbulbSSE4;
+    default:                  return realPowerMandelbulb;
+    }
+}
+
+template <int N>
+inline MandelbulbKernel integerPowerKernel(CpuDispatch::Isa isa) {
+    switch (isa) {
+    case CpuDispatch::AVX512: return integerPowerMandelbulbAVX512<N>;
+    case CpuDispatch::AVX2:   return integerPowerMandelbulbAVX2<N>;
+    case CpuDispatch::SSE4:   return integerPowerMandelbulbSSE4<N>;
+    default:                  return integerPowerMandelbulb<N>;
+    }
+}
+
 
 class Mandelbulb : public Shape {
 protected:
@@ -11,18 +264,73 @@ protected:
     /* Different values give different shapes; 8.0 is the "standard" bulb */
     float power;
 
+    /* Chosen once for power and CpuDispatch::active(). Integer powers 2 through 16 have trig-free kernels. */
+    MandelbulbKernel kernel;
+
+public:
+
+    Mandelbulb(float power = 8.0f) : power(power), kernel(realPowerKernel(CpuDispatch::active())) {
+        typedef MandelbulbKernel (*KernelForIsa)(CpuDispatch::Isa);
+        static const KernelForIsa integerKernel[17] = {
+            NULL, NULL,
+            integerPowerKernel<2>,  integerPowerKernel<3>,  integerPowerKernel<4>,
+            integerPowerKernel<5>,  integerPowerKernel<6>,  integerPowerKernel<7>,
+            integerPowerKernel<8>,  integerPowerKernel<9>,  integerPowerKernel<10>,
+            integerPowerKernel<11>, integerPowerKernel<12>, integerPowerKernel<13>,
+            integerPowerKernel<14>, integerPowerKernel<15>, integerPowerKernel<16>};
+
+        if ((power >= 2.0f) && (power <= 16.0f) && (power == float(int(power)))) {
+            kernel = integerKernel[int(power)](CpuDispatch::active());
+        }
+    }
+
+    virtual void getDistanceAndShade(const Point3& point, float& distance, float& shade) const override final {
+        kernel(rotation, power, point, 0.0f, distance, shade);
+    }
+
+    virtual void getCoarseDistanceAndShade(const Point3& point, float footprint, float& distance, float& shade) const override final {
+        kernel(rotation, power, point, footprint, distance, shade);
+    }
+};
+
+
+/** A Mandelbulb whose integer power is fixed at compile time, so that
+    its trig-free kernel is inlined wherever the type is known. */
+template <int POWER>
+class FixedMandelbulb : public Shape {
 public:
-    
-    Mandelbulb(float power = 8.0f);
 
-    virtual void getDistanceAndShade(const Point3& point, float& distance, float& shade) const override;
+    virtual void getDistanceAndShade(const Point3& point, float& distance, float& shade) const override final {
+        mandelbulbDistanceAndShade(rotation, IntegerSphericalPower<POWER>(), point, 0.0f, distance, shade);
+    }
+
+    virtual void getCoarseDistanceAndShade(const Point3& point, float footprint, float& distance, float& shade) const override final {
+        mandelbulbDistanceAndShade(rotation, IntegerSphericalPower<POWER>(), point, footprint, distance, shade);
+    }
 };
 
 
 class RoundBox : public Shape {
 public:
 
-    virtual void getDistanceAndShade(const Point3& point, float& distance, float& shade) const override;
+    virtual void getDistanceAndShade(const Point3& point, float& distance, float& shade) const override final {
+        // Rotate the query point into the reference frame of the function
+        // 3x3 matrix-vector product
+        const Point3& P = rotation * point;
+        shade = 1.0f;
+
+        // Sample distance function for a sphere:
+        // distance = length(P) - 0.5f; return;
+
+        const float side = 0.5f;
+        // Unit rounded box (http://www.iquilezles.org/www/articles/distfunctions/distfunctions.htm)
+        distance = length(max(abs(P) - Vector3(1.0f, 1.0f, 1.0f) * side, Vector3(0.0f, 0.0f, 0.0f))) - 0.1f * side;
+    }
+
+    /* The box has no fine detail */
+    virtual void getCoarseDistanceAndShade(const Point3& point, float footprint, float& distance, float& shade) const override final {
+        RoundBox::getDistanceAndShade(point, distance, shade);
+    }
 };
 
 #endif
@@ -0,0 +1,341 @@
+// Bryan Jones and Melanie Subbiah (2014)
+// All rights reserved
+
+#include <cstddef>
+#include <cstdlib>
+#include "Raster.h"
+#include "Framebuffer.h"
+
+bool clipLine(float& x0, float& y0, float& x1, float& y1, float xMin, float yMin, float xMax, float yMax) {
+    // http://en.wikipedia.org/wiki/Liang%E2%80%93Barsky_algorithm
+    // The segment is P(t) = P0 + t (P1 - P0) on t = [0, 1]. Each edge
+    // either moves the entering t up or the leaving t down.
+    const float dx = x1 - x0;
+    const float dy = y1 - y0;
+    const float p[4] = {-dx, dx, -dy, dy};
+    const float q[4] = {x0 - xMin, xMax - x0, y0 - yMin, yMax - y0};
+
+    float enter = 0.0f;
+    float leave = 1.0f;
+    for (int i = 0; i < 4; ++i) {
+        if (p[i] == 0.0f) {
+            // Parallel to this edge
+            if (q[i] < 0.0f) { return false; }
+        } else {
+            const float t = q[i] / p[i];
+            if (p[i] < 0.0f) {
+                enter = max(enter, t);
+            } else {
+                leave = min(leave, t);
+            }
+        }
+    }
+    if (enter > leave) { return false; }
+
+    const float ox = x0, oy = y0;
+    x0 = ox + enter * dx;
+    y0 = oy + enter * dy;
+    x1 = ox + leave * dx;
+    y1 = oy + leave * dy;
+    return true;
+}
+
+
+/* Write one color to pixel i = y * width + x through pointers into the
+   storage of one Framebuffer format, resolved and encoded once per line
+   instead of on every Framebuffer::set() */
+class PlaneWriter {
+private:
+    float*  m_r;
+    float*  m_g;
+    float*  m_b;
+    Color   m_color;
+
+public:
+    PlaneWriter(Framebuffer& image, const Color& c) :
+        m_r(image.planeRow(0, 0)), m_g(image.planeRow(1, 0)), m_b(image.planeRow(2, 0)), m_color(c) {}
+
+    void operator()(ptrdiff_t i) const {
+        m_r[i] = m_color.r;
+        m_g[i] = m_color.g;
+        m_b[i] = m_color.b;
+    }
+};
+
+
+template <class T>
+class InterleavedWriter {
+private:
+    T*      m_rgb;
+    T       m_value[3];
+
+public:
+    /** value is the encoded color */
+    InterleavedWriter(T* rgb, const T* value) : m_rgb(rgb) {
+        m_value[0] = value[0];
+        m_value[1] = value[1];
+        m_value[2] = value[2];
+    }
+
+    void operator()(ptrdiff_t i) const {
+        T* p = m_rgb + 3 * i;
+        p[0] = m_value[0];
+        p[1] = m_value[1];
+        p[2] = m_value[2];
+    }
+};
+
+
+/* Calls draw(writer) with the writer for image's format */
+template <class Draw>
+static void drawWith(Framebuffer& image, const Color& c, const Draw& draw) {
+    switch (image.format()) {
+    case Framebuffer::FLOAT32:
+        draw(PlaneWriter(image, c));
+        break;
+    case Framebuffer::HALF16:
+        {
+            uint16_t value[3];
+            Framebuffer::encode(c, value);
+            draw(InterleavedWriter<uint16_t>(image.halfRow(0), value));
+        }
+        break;
+    case Framebuffer::SRGB8:
+        {
+            unsigned char value[3];
+            image.encode(c, value);
+            draw(InterleavedWriter<unsigned char>(image.byteRow(0), value));
+        }
+        break;
+    }
+}
+
+
+/* Clips the line to the image and rounds the clipped endpoints back to
+   pixels, which keeps them inside the image. Returns false if no part
+   of the line is inside. */
+static bool clipToImage(const Framebuffer& image, int& x0, int& y0, int& x1, int& y1) {
+    float fx0 = float(x0), fy0 = float(y0), fx1 = float(x1), fy1 = float(y1);
+    if (! clipLine(fx0, fy0, fx1, fy1, 0.0f, 0.0f, float(image.width() - 1), float(image.height() - 1))) {
+        return false;
+    }
+    x0 = int(fx0 + 0.5f); y0 = int(fy0 + 0.5f);
+    x1 = int(fx1 + 0.5f); y1 = int(fy1 + 0.5f);
+    return true;
+}
+
+
+/* Plots the line between two pixels inside an image of the given width */
+template <class Writer>
+static void bresenham(const Writer& plot, int width, int x0, int y0, int x1, int y1) {
+    ptrdiff_t i = ptrdiff_t(y0) * width + x0;
+
+    if (y0 == y1) {
+        // Horizontal: one span
+        const ptrdiff_t first = i + min(x1 - x0, 0);
+        const int count = std::abs(x1 - x0) + 1;
+        for (int j = 0; j < count; ++j) { plot(first + j); }
+        return;
+    }
+
+    // http://en.wikipedia.org/wiki/Bresenham%27s_line_algorithm
+    // The error term tracks the distance from the ideal line scaled by 2 dx dy
+    const int dx = std::abs(x1 - x0);
+    const int dy = -std::abs(y1 - y0);
+    const int sx = (x0 < x1) ? 1 : -1;
+    const int sy = (y0 < y1) ? 1 : -1;
+    const ptrdiff_t rowStep = (y0 < y1) ? width : -width;
+    int error = dx + dy;
+
+    while (true) {
+        plot(i);
+        if ((x0 == x1) && (y0 == y1)) { break; }
+        const int e2 = 2 * error;
+        if (e2 >= dy) { error += dy; x0 += sx; i += sx; }
+        if (e2 <= dx) { error += dx; y0 += sy; i += rowStep; }
+    }
+}
+
+
+class DrawLine {
+private:
+    int m_width, m_x0, m_y0, m_x1, m_y1;
+
+public:
+    DrawLine(int width, int x0, int y0, int x1, int y1) : m_width(width), m_x0(x0), m_y0(y0), m_x1(x1), m_y1(y1) {}
+
+    template <class Writer>
+    void operator()(const Writer& plot) const {
+        bresenham(plot, m_width, m_x0, m_y0, m_x1, m_y1);
+    }
+};
+
+
+void rasterizeLine(Framebuffer& image, int x0, int y0, int x1, int y1, const Color& c) {
+    if (! clipToImage(image, x0, y0, x1, y1)) { return; }
+    image.markDirty(min(y0, y1), max(y0, y1));
+    drawWith(image, c, DrawLine(image.width(), x0, y0, x1, y1));
+}
+
+
+/* Blends c over pixel (x, y) with the given coverage, ignoring pixels outside the image */
+static inline void plotCoverage(Framebuffer& image, int x, int y, const Color& c, float coverage) {
+    if (image.inBounds(x, y)) {
+        image.set(x, y, mix(image.get(x, y), c, coverage));
+    }
+}
+
+
+static inline float fractionalPart(float x) {
+    return x - std::floor(x);
+}
+
+
+void rasterizeLineAA(Framebuffer& image, float x0, float y0, float x1, float y1, const Color& c) {
+    // Allow one pixel of margin for the partially covered neighbors
+    if (! clipLine(x0, y0, x1, y1, -1.0f, -1.0f, float(image.width()), float(image.height()))) {
+        return;
+    }
+    image.markDirty(int(std::floor(min(y0, y1))) - 1, int(std::floor(max(y0, y1))) + 1);
+
+    // http://en.wikipedia.org/wiki/Xiaolin_Wu%27s_line_algorithm
+    // Step along the major axis; swap coordinates so that it is x
+    const bool steep = std::fabs(y1 - y0) > std::fabs(x1 - x0);
+    if (steep) {
+        std::swap(x0, y0);
+        std::swap(x1, y1);
+    }
+    if (x0 > x1) {
+        std::swap(x0, x1);
+        std::swap(y0, y1);
+    }
+
+    const float dx = x1 - x0;
+    const float gradient = (dx == 0.0f) ? 1.0f : (y1 - y0) / dx;
+
+    // The first endpoint
+    float xEnd = std::floor(x0 + 0.5f);
+    float yEnd = y0 + gradient * (xEnd - x0);
+    float xGap = 1.0f - fractionalPart(x0 + 0.5f);
+    const int xStart = int(xEnd);
+    {
+        const int y = int(std::floor(yEnd));
+        const float f = fractionalPart(yEnd);
+        if (steep) {
+            plotCoverage(image, y, xStart, c, (1.0f - f) * xGap);
+            plotCoverage(image, y + 1, xStart, c, f * xGap);
+        } else {
+            plotCoverage(image, xStart, y, c, (1.0f - f) * xGap);
+            plotCoverage(image, xStart, y + 1, c, f * xGap);
+        }
+    }
+    float yIntersect = yEnd + gradient;
+
+    // The second endpoint
+    xEnd = std::floor(x1 + 0.5f);
+    yEnd = y1 + gradient * (xEnd - x1);
+    xGap = fractionalPart(x1 + 0.5f);
+    const int xStop = int(xEnd);
+    {
+        const int y = int(std::floor(yEnd));
+        const float f = fractionalPart(yEnd);
+        if (steep) {
+            plotCoverage(image, y, xStop, c, (1.0f - f) * xGap);
+            plotCoverage(image, y + 1, xStop, c, f * xGap);
+        } else {
+            plotCoverage(image, xStop, y, c, (1.0f - f) * xGap);
+            plotCoverage(image, xStop, y + 1, c, f * xGap);
+        }
+    }
+
+    // Between the endpoints, split each column between the two pixels the line passes
+    for (int x = xStart + 1; x < xStop; ++x, yIntersect += gradient) {
+        const int y = int(std::floor(yIntersect));
+        const float f = fractionalPart(yIntersect);
+        if (steep) {
+            plotCoverage(image, y, x, c, 1.0f - f);
+            plotCoverage(image, y + 1, x, c, f);
+        } else {
+            plotCoverage(image, x, y, c, 1.0f - f);
+            plotCoverage(image, x, y + 1, c, f);
+        }
+    }
+}
+
+
+static inline int nearestPixel(float x) {
+    return int(std::floor(x + 0.5f));
+}
+
+
+/* All segments of a polyline through one writer */
+class DrawPolyline {
+private:
+    const Framebuffer&  m_image;
+    const Point2*       m_point;
+    int                 m_count;
+
+public:
+    DrawPolyline(const Framebuffer& image, const Point2* point, int count) : m_image(image), m_point(point), m_count(count) {}
+
+    template <class Writer>
+    void operator()(const Writer& plot) const {
+        for (int i = 0; i + 1 < m_count; ++i) {
+            int x0 = nearestPixel(m_point[i].x), y0 = nearestPixel(m_point[i].y);
+            int x1 = nearestPixel(m_point[i + 1].x), y1 = nearestPixel(m_point[i + 1].y);
+            if (clipToImage(m_image, x0, y0, x1, y1)) {
+                bresenham(plot, m_image.width(), x0, y0, x1, y1);
+            }
+        }
+    }
+};
+
+
+void rasterizePolyline(Framebuffer& image, const Point2* point, int count, const Color& c, bool antialiased) {
+    if (antialiased) {
+        for (int i = 0; i + 1 < count; ++i) {
+            rasterizeLineAA(image, point[i].x, point[i].y, point[i + 1].x, point[i + 1].y, c);
+        }
+        return;
+    }
+    if (count < 2) { return; }
+
+    // Clipping keeps each segment within the rows its endpoints span, so
+    // one range covers them all
+    int yMin = nearestPixel(point[0].y), yMax = yMin;
+    for (int i = 1; i < count; ++i) {
+        yMin = min(yMin, nearestPixel(point[i].y));
+        yMax = max(yMax, nearestPixel(point[i].y));
+    }
+    image.markDirty(yMin, yMax);
+    drawWith(image, c, DrawPolyline(image, point, count));
+}
+
+
+class DrawVerticalRun {
+private:
+    ptrdiff_t   m_first;
+    int         m_count;
+    int         m_width;
+
+public:
+    DrawVerticalRun(ptrdiff_t first, int count, int width) : m_first(first), m_count(count), m_width(width) {}
+
+    template <class Writer>
+    void operator()(const Writer& plot) const {
+        ptrdiff_t i = m_first;
+        for (int j = 0; j < m_count; ++j, i += m_width) { plot(i); }
+    }
+};
+
+
+void rasterizeVerticalSpan(Framebuffer& image, int x, int y0, int y1, const Color& c) {
+    if ((x < 0) || (x >= image.width())) { return; }
+    if (y0 > y1) { std::swap(y0, y1); }
+    y0 = max(y0, 0);
+    y1 = min(y1, image.height() - 1);
+    if (y0 > y1) { return; }
+
+    image.markDirty(y0, y1);
+    drawWith(image, c, DrawVerticalRun(ptrdiff_t(y0) * image.width() + x, y1 - y0 + 1, image.width()));
+}
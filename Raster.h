@@ -0,0 +1,33 @@
+// Bryan Jones and Melanie Subbiah (2014)
+// All rights reserved
+
+#ifndef Raster_h
+#define Raster_h
+
+#include "math3d.h"
+
+class Framebuffer;
+
+/* Line rasterization directly into a Framebuffer. Lines are clipped
+   to the image, so endpoints may lie anywhere, and the rows written
+   are reported with Framebuffer::markDirty(). */
+
+/** Liang-Barsky clipping of the segment to the rectangle [xMin, xMax] x [yMin, yMax].
+    Returns false if no part of the segment is inside. */
+bool clipLine(float& x0, float& y0, float& x1, float& y1, float xMin, float yMin, float xMax, float yMax);
+
+/** 1-pixel line by integer Bresenham */
+void rasterizeLine(Framebuffer& image, int x0, int y0, int x1, int y1, const Color& c);
+
+/** Antialiased line by Xiaolin Wu's algorithm. Coordinates are in
+    pixels, with integers at pixel centers. Coverage is blended over
+    the existing image. */
+void rasterizeLineAA(Framebuffer& image, float x0, float y0, float x1, float y1, const Color& c);
+
+/** Connected segments through count points */
+void rasterizePolyline(Framebuffer& image, const Point2* point, int count, const Color& c, bool antialiased = false);
+
+/** Vertical run of pixels from (x, y0) to (x, y1), inclusive */
+void rasterizeVerticalSpan(Framebuffer& image, int x, int y0, int y1, const Color& c);
+
+#endif
@@ -0,0 +1,132 @@
+// Bryan Jones and Melanie Subbiah (2014)
+// All rights reserved
+
+#ifndef RootBuffer_h
+#define RootBuffer_h
+
+#include <cassert>
+#include <vector>
+#include "math3d.h"
+
+/** Caller-owned storage that the root finders write roots into without
+    allocating. Roots found past the capacity are counted but dropped, so
+    a caller can tell that it needs a larger buffer. A buffer over a
+    std::vector instead grows the vector, so that no root is dropped. */
+class RootBuffer {
+private:
+    float*              m_root;
+    int                 m_capacity;
+
+    /* Roots pushed, including those that did not fit */
+    int                 m_found;
+
+    /* For a growing buffer, the vector and the index of the first root in it */
+    std::vector<float>* m_vector;
+    size_t              m_first;
+
+    /* A buffer refers to one block of storage */
+    RootBuffer(const RootBuffer&);
+    RootBuffer& operator=(const RootBuffer&);
+
+    void grow() {
+        m_capacity = (m_capacity < 8) ? 16 : 2 * m_capacity;
+        m_vector->resize(m_first + m_capacity);
+        m_root = &(*m_vector)[m_first];
+    }
+
+public:
+
+    RootBuffer(float* root, int capacity) : m_root(root), m_capacity(capacity), m_found(0), m_vector(NULL), m_first(0) {
+        assert((capacity == 0) || (root != NULL));
+    }
+
+    /** Appends roots to root, growing it as roots are pushed. Entries past
+        the roots are left in the vector until trim() removes them. */
+    explicit RootBuffer(std::vector<float>& root) : m_root(NULL), m_capacity(0), m_found(0), m_vector(&root), m_first(root.size()) {}
+
+    void push(float x) {
+        if ((m_found == m_capacity) && (m_vector != NULL)) { grow(); }
+        if (m_found < m_capacity) { m_root[m_found] = x; }
+        ++m_found;
+    }
+
+    /** For a growing buffer, shrinks the vector to end at the last root */
+    void trim() {
+        if (m_vector != NULL) { m_vector->resize(m_first + size()); }
+    }
+
+    /** Roots stored */
+    int size() const {
+        return (m_found < m_capacity) ? m_found : m_capacity;
+    }
+
+    /** Roots pushed, which exceeds size() if the buffer overflowed */
+    int found() const {
+        return m_found;
+    }
+
+    bool overflowed() const {
+        return m_found > m_capacity;
+    }
+
+    int capacity() const {
+        return m_capacity;
+    }
+
+    void clear() {
+        m_found = 0;
+    }
+
+    float operator[](int i) const {
+        assert((i >= 0) && (i < size()));
+        return m_root[i];
+    }
+
+    float* begin() { return m_root; }
+    float* end() { return m_root + size(); }
+};
+
+
+/** A RootBuffer with its storage inline, for use on the stack */
+template <int N>
+class FixedRootBuffer : public RootBuffer {
+private:
+    float m_storage[N];
+
+public:
+    FixedRootBuffer() : RootBuffer(m_storage, N) {}
+};
+
+
+/** Scratch memory for the root finders, reused across calls. Finding the roots
+    of a polynomial of degree up to the reserved degree does not allocate; a
+    higher degree grows the workspace once. Use one workspace per thread. */
+class RootWorkspace {
+public:
+    /* The polynomial left after dividing out the roots found so far */
+    Polynomial quotient;
+
+    /* The derivative of the polynomial being solved */
+    Polynomial derivative;
+
+    explicit RootWorkspace(int maxDegree = 8) : quotient(std::vector<float>()), derivative(std::vector<float>()) {
+        reserve(maxDegree);
+    }
+
+    void reserve(int maxDegree) {
+        quotient.reserve(maxDegree);
+        derivative.reserve((maxDegree > 1) ? maxDegree - 1 : 0);
+    }
+};
+
+
+/** Appends the roots that find(RootBuffer&) writes to root. The buffer
+    grows root as it fills, so find runs once however many roots there are. */
+template <class Find>
+void appendRoots(std::vector<float>& root, const Find& find) {
+    RootBuffer buffer(root);
+    find(buffer);
+    buffer.trim();
+}
+
+#endif
@@ -0,0 +1,131 @@
+// Bryan Jones and Melanie Subbiah (2014)
+// All rights reserved
+
+#include <stdio.h>
+#include <vector>
+#include <mutex>
+#include "Stats.h"
+
+/* Blocks for the first threads to record. Handing these out instead of
+   allocating keeps the root finders allocation-free in stats builds. */
+static const int PREALLOCATED_BLOCKS = 64;
+static Stats::Block preallocatedBlock[PREALLOCATED_BLOCKS];
+
+/* Every block ever handed out: the first preallocatedCount of
+   preallocatedBlock, then any allocated for later threads. Blocks are
+   never freed, so that counts from threads that have exited are still
+   collected. */
+static std::mutex registryMutex;
+static int preallocatedCount = 0;
+static std::vector<Stats::Block*> allocatedBlock;
+
+
+/* Block i of those handed out. Call with registryMutex held. */
+static Stats::Block& registeredBlock(size_t i) {
+    return (i < size_t(preallocatedCount)) ? preallocatedBlock[i] : *allocatedBlock[i - preallocatedCount];
+}
+
+
+static size_t registeredBlockCount() {
+    return size_t(preallocatedCount) + allocatedBlock.size();
+}
+
+
+Stats::Block::Block() : pixelMarchSteps(0) {
+    for (int i = 0; i < NUM_COUNTERS; ++i) { m_counter[i] = 0; }
+    for (int i = 0; i < NUM_PHASES; ++i) { m_nanoseconds[i] = 0; }
+    for (int i = 0; i < HISTOGRAM_SIZE; ++i) { m_marchStepHistogram[i] = 0; }
+}
+
+
+Stats::Block& Stats::local() {
+    static thread_local Block* block = NULL;
+    if (block == NULL) {
+        std::lock_guard<std::mutex> lock(registryMutex);
+        if (preallocatedCount < PREALLOCATED_BLOCKS) {
+            block = &preallocatedBlock[preallocatedCount++];
+        } else {
+            block = new Block();
+            allocatedBlock.push_back(block);
+        }
+    }
+    return *block;
+}
+
+
+Stats::Totals Stats::collect() {
+    Totals t;
+    for (int i = 0; i < NUM_COUNTERS; ++i) { t.counter[i] = 0; }
+    for (int i = 0; i < NUM_PHASES; ++i) { t.nanoseconds[i] = 0; }
+    for (int i = 0; i < HISTOGRAM_SIZE; ++i) { t.marchStepHistogram[i] = 0; }
+
+    std::lock_guard<std::mutex> lock(registryMutex);
+    for (size_t b = 0; b < registeredBlockCount(); ++b) {
+        const Block& block = registeredBlock(b);
+        for (int i = 0; i < NUM_COUNTERS; ++i) { t.counter[i] += block.m_counter[i].load(std::memory_order_relaxed); }
+        for (int i = 0; i < NUM_PHASES; ++i) { t.nanoseconds[i] += block.m_nanoseconds[i].load(std::memory_order_relaxed); }
+        for (int i = 0; i < HISTOGRAM_SIZE; ++i) {
+            t.marchStepHistogram[i] += block.m_marchStepHistogram[i].load(std::memory_order_relaxed);
+        }
+    }
+    return t;
+}
+
+
+void Stats::reset() {
+    std::lock_guard<std::mutex> lock(registryMutex);
+    for (size_t b = 0; b < registeredBlockCount(); ++b) {
+        Block& block = registeredBlock(b);
+        for (int i = 0; i < NUM_COUNTERS; ++i) { block.m_counter[i] = 0; }
+        for (int i = 0; i < NUM_PHASES; ++i) { block.m_nanoseconds[i] = 0; }
+        for (int i = 0; i < HISTOGRAM_SIZE; ++i) { block.m_marchStepHistogram[i] = 0; }
+    }
+}
+
+
+const char* Stats::name(Counter c) {
+    static const char* names[NUM_COUNTERS] = {
+        "evaluations", "rootSearches", "brackets", "bisectionSteps", "newtonIterations",
+        "convergenceFailures", "rays", "rayHits", "marchSteps"
+    };
+    return names[c];
+}
+
+
+const char* Stats::name(Phase p) {
+    static const char* names[NUM_PHASES] = {"scan", "refine", "march", "shade"};
+    return names[p];
+}
+
+
+bool Stats::writeJSON(const std::string& filename) {
+    const Totals& t = collect();
+
+    FILE* file = fopen(filename.c_str(), "wt");
+    if (file == NULL) { return false; }
+
+    fprintf(file, "{\n  \"counters\": {");
+    for (int i = 0; i < NUM_COUNTERS; ++i) {
+        fprintf(file, "%s\n    \"%s\": %llu", (i > 0) ? "," : "", name(Counter(i)), (unsigned long long)t.counter[i]);
+    }
+
+    // Averages per call, which are what we usually want to compare
+    const uint64_t calls = t.counter[ROOT_SEARCHES] + t.counter[RAYS];
+    fprintf(file, "\n  },\n  \"evaluationsPerCall\": %.3f,\n  \"marchStepsPerRay\": %.3f,\n  \"milliseconds\": {",
+            (calls > 0) ? double(t.counter[EVALUATIONS]) / double(calls) : 0.0,
+            (t.counter[RAYS] > 0) ? double(t.counter[MARCH_STEPS]) / double(t.counter[RAYS]) : 0.0);
+    for (int i = 0; i < NUM_PHASES; ++i) {
+        fprintf(file, "%s\n    \"%s\": %.3f", (i > 0) ? "," : "", name(Phase(i)), double(t.nanoseconds[i]) * 1e-6);
+    }
+
+    // Trailing zero buckets are omitted
+    int last = HISTOGRAM_SIZE - 1;
+    while ((last > 0) && (t.marchStepHistogram[last] == 0)) { --last; }
+    fprintf(file, "\n  },\n  \"marchStepHistogram\": [");
+    for (int i = 0; i <= last; ++i) {
+        fprintf(file, "%s%llu", (i > 0) ? ", " : "", (unsigned long long)t.marchStepHistogram[i]);
+    }
+    fprintf(file, "]\n}\n");
+
+    return fclose(file) == 0;
+}
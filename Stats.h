@@ -0,0 +1,153 @@
+// Bryan Jones and Melanie Subbiah (2014)
+// All rights reserved
+
+#ifndef Stats_h
+#define Stats_h
+
+#include <string>
+#include <atomic>
+#include <chrono>
+#include <stdint.h>
+
+/* Counters and timers for the root finders and the ray marcher.
+
+   Compile with -DROOTFINDER_STATS to enable them. Otherwise the
+   STATS_ macros expand to nothing and cost nothing. Each thread
+   records into its own block, so recording never contends; collect()
+   sums the blocks of all threads. Blocks for the first 64 threads are
+   preallocated, so recording does not allocate either. */
+class Stats {
+public:
+
+    enum Counter {
+        /** Calls to a Function, including those made by numerical derivatives */
+        EVALUATIONS,
+
+        /** findRoots() and findRoots_N() calls */
+        ROOT_SEARCHES,
+
+        /** Sign changes found by the linear scans */
+        BRACKETS,
+
+        /** Levels of binarySearch() recursion */
+        BISECTION_STEPS,
+
+        NEWTON_ITERATIONS,
+
+        /** Searches that stopped at their iteration limit without meeting their tolerance */
+        CONVERGENCE_FAILURES,
+
+        /** findSmallestRootOfDistanceFunction() calls */
+        RAYS,
+        RAY_HITS,
+
+        /** Sphere tracing steps over all rays */
+        MARCH_STEPS,
+
+        NUM_COUNTERS
+    };
+
+    /** Timed phases. Times are inclusive: REFINE time is also counted in the SCAN or MARCH that called it. */
+    enum Phase {
+        /** Linear scans for brackets */
+        SCAN,
+
+        /** Bisection and Newton refinement */
+        REFINE,
+
+        /** Sphere tracing */
+        MARCH,
+
+        /** Normals and lighting after a ray hit */
+        SHADE,
+
+        NUM_PHASES
+    };
+
+    /** Rays that took i march steps go in bucket i; the last bucket also holds longer rays */
+    static const int HISTOGRAM_SIZE = 128;
+
+    struct Totals {
+        uint64_t  counter[NUM_COUNTERS];
+        uint64_t  nanoseconds[NUM_PHASES];
+        uint64_t  marchStepHistogram[HISTOGRAM_SIZE];
+    };
+
+    /** One thread's statistics. Only its own thread writes to it. */
+    class Block {
+    private:
+        friend class Stats;
+
+        std::atomic<uint64_t>  m_counter[NUM_COUNTERS];
+        std::atomic<uint64_t>  m_nanoseconds[NUM_PHASES];
+        std::atomic<uint64_t>  m_marchStepHistogram[HISTOGRAM_SIZE];
+
+        /* Single writer, so a relaxed load and store avoids a locked read-modify-write */
+        static void add(std::atomic<uint64_t>& a, uint64_t v) {
+            a.store(a.load(std::memory_order_relaxed) + v, std::memory_order_relaxed);
+        }
+
+    public:
+        /** March steps recorded on this thread since the caller last zeroed it, for per-pixel heatmaps */
+        int pixelMarchSteps;
+
+        Block();
+
+        void count(Counter c, uint64_t n = 1) {
+            add(m_counter[c], n);
+        }
+
+        void time(Phase p, uint64_t nanoseconds) {
+            add(m_nanoseconds[p], nanoseconds);
+        }
+
+        void recordMarch(int steps) {
+            pixelMarchSteps += steps;
+            add(m_counter[MARCH_STEPS], steps);
+            add(m_marchStepHistogram[(steps < HISTOGRAM_SIZE) ? steps : HISTOGRAM_SIZE - 1], 1);
+        }
+    };
+
+    /** Adds its lifetime to a phase */
+    class ScopedTimer {
+    private:
+        Phase                                   m_phase;
+        std::chrono::steady_clock::time_point   m_start;
+    public:
+        explicit ScopedTimer(Phase p) : m_phase(p), m_start(std::chrono::steady_clock::now()) {}
+        ~ScopedTimer() {
+            local().time(m_phase, std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - m_start).count());
+        }
+    };
+
+    /** The calling thread's block */
+    static Block& local();
+
+    /** Sums over all threads that have recorded anything */
+    static Totals collect();
+
+    /** Zeroes every thread's block */
+    static void reset();
+
+    /** Writes collect() as JSON. Returns false if the file could not be written. */
+    static bool writeJSON(const std::string& filename);
+
+    static const char* name(Counter c);
+    static const char* name(Phase p);
+};
+
+#ifdef ROOTFINDER_STATS
+#   define STATS_CONCAT_(a, b) a##b
+#   define STATS_CONCAT(a, b) STATS_CONCAT_(a, b)
+#   define STATS_COUNT(counter)             Stats::local().count(Stats::counter)
+#   define STATS_COUNT_N(counter, n)        Stats::local().count(Stats::counter, (n))
+#   define STATS_TIME(phase)                Stats::ScopedTimer STATS_CONCAT(statsTimer, __LINE__)(Stats::phase)
+#   define STATS_RECORD_MARCH(steps)        Stats::local().recordMarch(steps)
+#else
+#   define STATS_COUNT(counter)             ((void)0)
+#   define STATS_COUNT_N(counter, n)        ((void)0)
+#   define STATS_TIME(phase)                ((void)0)
+#   define STATS_RECORD_MARCH(steps)        ((void)0)
+#endif
+
+#endif
@@ -0,0 +1,79 @@
+// Bryan Jones and Melanie Subbiah (2014)
+// All rights reserved
+
+#define GL_GLEXT_PROTOTYPES
+#include <GL/glut.h>
+#include <GL/glext.h>
+#include <cassert>
+#include "TextureStream.h"
+#include "Framebuffer.h"
+
+TextureStream::TextureStream() : m_texture(0), m_gamma(1.0f, 1.0f), m_width(0), m_height(0), m_rowBytes(0), m_current(0) {
+    for (int i = 0; i < 2; ++i) {
+        m_pixelBuffer[i] = 0;
+        m_stagedY[i] = 0;
+        m_stagedCount[i] = 0;
+    }
+}
+
+
+void TextureStream::init(const Framebuffer& framebuffer, const GammaTable& gamma) {
+    m_width = framebuffer.width();
+    m_height = framebuffer.height();
+    m_rowBytes = size_t(m_width) * 3;
+    m_gamma = gamma;
+    m_row.resize(m_width);
+
+    // Allocate texture storage once; upload() only replaces rows
+    glGenTextures(1, &m_texture);
+    glBindTexture(GL_TEXTURE_2D, m_texture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB8, m_width, m_height, 0, GL_RGB, GL_UNSIGNED_BYTE, NULL);
+
+    glGenBuffers(2, m_pixelBuffer);
+    for (int i = 0; i < 2; ++i) {
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, m_pixelBuffer[i]);
+        glBufferData(GL_PIXEL_UNPACK_BUFFER, m_rowBytes * m_height, NULL, GL_STREAM_DRAW);
+    }
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+}
+
+
+void TextureStream::upload(Framebuffer& framebuffer) {
+    assert(framebuffer.width() == m_width && framebuffer.height() == m_height);
+
+    // Copy the rows staged by the previous call. This returns
+    // immediately; the driver reads from the buffer asynchronously.
+    if (m_stagedCount[m_current] > 0) {
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, m_pixelBuffer[m_current]);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, m_stagedY[m_current], m_width, m_stagedCount[m_current],
+                        GL_RGB, GL_UNSIGNED_BYTE, NULL);
+        m_stagedCount[m_current] = 0;
+    }
+
+    // Stage the rows that changed since the previous call in the other buffer
+    const int next = 1 - m_current;
+    int y, count;
+    if (framebuffer.takeDirtyRows(y, count)) {
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, m_pixelBuffer[next]);
+
+        // Orphan the old storage so that mapping does not wait for a copy still in flight
+        glBufferData(GL_PIXEL_UNPACK_BUFFER, m_rowBytes * m_height, NULL, GL_STREAM_DRAW);
+        void* dst = glMapBuffer(GL_PIXEL_UNPACK_BUFFER, GL_WRITE_ONLY);
+        if (dst != NULL) {
+            unsigned char* out = static_cast<unsigned char*>(dst);
+            for (int i = 0; i < count; ++i, out += m_rowBytes) {
+                framebuffer.getRow(y + i, &m_row[0]);
+                m_gamma.encodeRGB(&m_row[0], m_width, out);
+            }
+            glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+            m_stagedY[next] = y;
+            m_stagedCount[next] = count;
+        } else {
+            // Try these rows again next time
+            framebuffer.markDirty(y, y + count - 1);
+        }
+    }
+
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    m_current = next;
+}
@@ -0,0 +1,58 @@
+// Bryan Jones and Melanie Subbiah (2014)
+// All rights reserved
+
+#ifndef TextureStream_h
+#define TextureStream_h
+
+#include <stddef.h>
+#include <vector>
+#include "ImageWriter.h"
+
+class Framebuffer;
+
+/** Streams the changed rows of a Framebuffer into a GL texture
+    through a pair of pixel buffer objects. Each upload() starts the
+    texture copy from the buffer filled by the previous call and then
+    fills the other buffer, so that the CPU never waits for the driver
+    to finish reading. The displayed image therefore lags the
+    framebuffer by one upload.
+
+    Rows are encoded to 8-bit RGB through a GammaTable as they are
+    staged, whatever the framebuffer format, so the display matches
+    images written with the same table. */
+class TextureStream {
+private:
+
+    /* GL object names (GLuint) */
+    unsigned int    m_texture;
+    unsigned int    m_pixelBuffer[2];
+
+    /* Exposure and gamma applied to staged rows */
+    GammaTable      m_gamma;
+
+    /* One decoded framebuffer row */
+    std::vector<Color> m_row;
+
+    int             m_width;
+    int             m_height;
+    size_t          m_rowBytes;
+
+    /* Pixel buffer that the next upload() copies to the texture */
+    int             m_current;
+
+    /* Rows staged in each pixel buffer, as [y, y + count) */
+    int             m_stagedY[2];
+    int             m_stagedCount[2];
+
+public:
+
+    TextureStream();
+
+    /** Creates and binds the texture and buffers. Requires a current GL context. */
+    void init(const Framebuffer& framebuffer, const GammaTable& gamma);
+
+    /** Consumes the framebuffer's dirty rows and copies them to the texture */
+    void upload(Framebuffer& framebuffer);
+};
+
+#endif
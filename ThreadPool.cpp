@@ -0,0 +1,94 @@
+// Bryan Jones and Melanie Subbiah (2014)
+// All rights reserved
+
+#include <cassert>
+#include "ThreadPool.h"
+
+/* True on threads that are currently running a task, to detect nested parallelFor() calls */
+static thread_local bool insideTask = false;
+
+ThreadPool::ThreadPool(int threadCount) :
+    m_generation(0), m_quit(false), m_task(NULL), m_count(0), m_next(0), m_busy(0) {
+
+    if (threadCount <= 0) {
+        threadCount = std::max(1, int(std::thread::hardware_concurrency()));
+    }
+    for (int i = 0; i < threadCount - 1; ++i) {
+        m_worker.push_back(std::thread(&ThreadPool::workerLoop, this));
+    }
+}
+
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_quit = true;
+    }
+    m_wake.notify_all();
+    for (size_t i = 0; i < m_worker.size(); ++i) {
+        m_worker[i].join();
+    }
+}
+
+
+void ThreadPool::runTasks() {
+    const bool wasInside = insideTask;
+    insideTask = true;
+    for (int i = m_next++; i < m_count; i = m_next++) {
+        (*m_task)(i);
+    }
+    insideTask = wasInside;
+}
+
+
+void ThreadPool::workerLoop() {
+    unsigned int generation = 0;
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_wake.wait(lock, [&] { return m_quit || (m_generation != generation); });
+            if (m_quit) { return; }
+            generation = m_generation;
+
+            // A worker that wakes late may find the job already finished
+            if ((m_task == NULL) || (m_next >= m_count)) { continue; }
+            ++m_busy;
+        }
+
+        runTasks();
+
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            --m_busy;
+        }
+        m_done.notify_all();
+    }
+}
+
+
+void ThreadPool::parallelFor(int count, const std::function<void(int)>& task) {
+    if (count <= 0) { return; }
+
+    if (insideTask || m_worker.empty() || (count == 1)) {
+        for (int i = 0; i < count; ++i) { task(i); }
+        return;
+    }
+
+    std::lock_guard<std::mutex> jobLock(m_jobMutex);
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_task = &task;
+        m_count = count;
+        m_next = 0;
+        ++m_generation;
+    }
+    m_wake.notify_all();
+
+    runTasks();
+
+    // Every index has been claimed; wait for workers still finishing theirs.
+    // A worker that wakes after this point finds no indices left and does not start.
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_done.wait(lock, [&] { return m_busy == 0; });
+    m_task = NULL;
+}
@@ -0,0 +1,65 @@
+// Bryan Jones and Melanie Subbiah (2014)
+// All rights reserved
+
+#ifndef ThreadPool_h
+#define ThreadPool_h
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+
+/** A fixed set of worker threads for data-parallel loops. */
+class ThreadPool {
+private:
+
+    std::vector<std::thread>        m_worker;
+
+    /* Serializes parallelFor() calls from different threads */
+    std::mutex                      m_jobMutex;
+
+    /* Guards the fields below, which describe the current job */
+    std::mutex                      m_mutex;
+    std::condition_variable         m_wake;
+    std::condition_variable         m_done;
+
+    /* Incremented for each job so that workers can tell a new job from a spurious wakeup */
+    unsigned int                    m_generation;
+    bool                            m_quit;
+
+    const std::function<void(int)>* m_task;
+    int                             m_count;
+    std::atomic<int>                m_next;
+
+    /* Workers still running the current job */
+    int                             m_busy;
+
+    void workerLoop();
+
+    /* Runs task indices until none remain */
+    void runTasks();
+
+public:
+
+    /** threadCount is the number of threads that run tasks, including
+        the one that calls parallelFor(). 0 means one per hardware thread. */
+    explicit ThreadPool(int threadCount = 0);
+
+    ~ThreadPool();
+
+    /** Number of threads that run tasks, including the caller */
+    int size() const {
+        return int(m_worker.size()) + 1;
+    }
+
+    /** Calls task(i) for every i on [0, count) and returns when all
+        calls are complete. The calling thread runs tasks too. Indices
+        are handed out one at a time, so tasks of uneven cost balance
+        across threads. Calls from inside a task run serially on the
+        calling thread. */
+    void parallelFor(int count, const std::function<void(int)>& task);
+};
+
+#endif
@@ -0,0 +1,428 @@
+// Bryan Jones and Melanie Subbiah (2014)
+// All rights reserved
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <arpa/inet.h>
+#include <cassert>
+#include <chrono>
+#include <deque>
+#include "TileFarm.h"
+#include "Framebuffer.h"
+
+/* Type and payload length */
+static const size_t headerBytes = 8;
+
+/* Upper bound on any message that is not a RESULT */
+static const uint32_t maxControlBytes = 64;
+
+
+static long long currentMilliseconds() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+
+/* A socket of the family that address names, bound (listen) or connected to it. Returns -1 on failure. */
+static int openSocket(const std::string& address, bool listen, std::string& socketPath) {
+    if (address.compare(0, 5, "unix:") == 0) {
+        sockaddr_un addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        const std::string& path = address.substr(5);
+        if (path.empty() || (path.size() >= sizeof(addr.sun_path))) { return -1; }
+        memcpy(addr.sun_path, path.c_str(), path.size());
+
+        const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0) { return -1; }
+        if (listen) {
+            // A stale socket file from an earlier coordinator would make bind() fail
+            unlink(path.c_str());
+            if (bind(fd, (const sockaddr*)&addr, sizeof(addr)) == 0) {
+                socketPath = path;
+                return fd;
+            }
+        } else if (::connect(fd, (const sockaddr*)&addr, sizeof(addr)) == 0) {
+            return fd;
+        }
+        close(fd);
+        return -1;
+    }
+
+    const size_t colon = address.rfind(':');
+    if (colon == std::string::npos) { return -1; }
+    const std::string& host = address.substr(0, colon);
+    const std::string& port = address.substr(colon + 1);
+
+    addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = listen ? AI_PASSIVE : 0;
+
+    addrinfo* info = NULL;
+    if (getaddrinfo(host.empty() ? NULL : host.c_str(), port.c_str(), &hints, &info) != 0) { return -1; }
+
+    int fd = -1;
+    for (const addrinfo* a = info; (a != NULL) && (fd < 0); a = a->ai_next) {
+        fd = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+        if (fd < 0) { continue; }
+        bool ok;
+        if (listen) {
+            const int yes = 1;
+            setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+            ok = (bind(fd, a->ai_addr, a->ai_addrlen) == 0);
+        } else {
+            ok = (::connect(fd, a->ai_addr, a->ai_addrlen) == 0);
+        }
+        if (! ok) {
+            close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(info);
+    return fd;
+}
+
+
+static bool sendAll(int fd, const void* data, size_t size) {
+    const char* p = (const char*)data;
+    while (size > 0) {
+        // MSG_NOSIGNAL: a vanished peer is an error, not a SIGPIPE
+        const ssize_t n = send(fd, p, size, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) { continue; }
+            return false;
+        }
+        p += n;
+        size -= size_t(n);
+    }
+    return true;
+}
+
+
+static bool receiveAll(int fd, void* data, size_t size) {
+    char* p = (char*)data;
+    while (size > 0) {
+        const ssize_t n = recv(fd, p, size, 0);
+        if (n == 0) { return false; }
+        if (n < 0) {
+            if (errno == EINTR) { continue; }
+            return false;
+        }
+        p += n;
+        size -= size_t(n);
+    }
+    return true;
+}
+
+
+static void appendWord(std::vector<unsigned char>& data, uint32_t v) {
+    const uint32_t big = htonl(v);
+    const unsigned char* p = (const unsigned char*)&big;
+    data.insert(data.end(), p, p + 4);
+}
+
+
+static void appendFloat(std::vector<unsigned char>& data, float f) {
+    uint32_t bits;
+    memcpy(&bits, &f, sizeof(bits));
+    appendWord(data, bits);
+}
+
+
+static uint32_t readWord(const unsigned char* p) {
+    uint32_t big;
+    memcpy(&big, p, 4);
+    return ntohl(big);
+}
+
+
+static float readFloat(const unsigned char* p) {
+    const uint32_t bits = readWord(p);
+    float f;
+    memcpy(&f, &bits, sizeof(f));
+    return f;
+}
+
+
+/* Starts a message of type whose payload will be payloadBytes long */
+static void beginMessage(std::vector<unsigned char>& data, TileCoordinator::MessageType type, size_t payloadBytes) {
+    data.clear();
+    data.reserve(headerBytes + payloadBytes);
+    appendWord(data, uint32_t(type));
+    appendWord(data, uint32_t(payloadBytes));
+}
+
+////////////////////////////////////////////////////////////
+
+TileCoordinator::TileCoordinator(int imageWidth, int imageHeight, int tileTimeoutSeconds, int idleTimeoutSeconds) :
+    m_imageWidth(imageWidth), m_imageHeight(imageHeight), m_listener(-1),
+    m_tileTimeoutSeconds(tileTimeoutSeconds), m_idleTimeoutSeconds(idleTimeoutSeconds), m_nextTileId(0) {
+    assert((imageWidth > 0) && (imageHeight > 0));
+}
+
+
+TileCoordinator::~TileCoordinator() {
+    std::vector<unsigned char> quit;
+    beginMessage(quit, QUIT, 0);
+    while (! m_worker.empty()) {
+        sendAll(m_worker.back().fd, &quit[0], quit.size());
+        dropWorker(m_worker.size() - 1);
+    }
+    if (m_listener >= 0) { close(m_listener); }
+    if (! m_socketPath.empty()) { unlink(m_socketPath.c_str()); }
+}
+
+
+bool TileCoordinator::listen(const std::string& address) {
+    assert(m_listener < 0);
+    m_listener = openSocket(address, true, m_socketPath);
+    if ((m_listener >= 0) && (::listen(m_listener, 64) != 0)) {
+        close(m_listener);
+        m_listener = -1;
+    }
+    return m_listener >= 0;
+}
+
+
+void TileCoordinator::acceptWorkers() {
+    std::vector<unsigned char> hello;
+    beginMessage(hello, HELLO, 8);
+    appendWord(hello, uint32_t(m_imageWidth));
+    appendWord(hello, uint32_t(m_imageHeight));
+
+    while (true) {
+        pollfd p = {m_listener, POLLIN, 0};
+        if ((poll(&p, 1, 0) <= 0) || ! (p.revents & POLLIN)) { return; }
+
+        const int fd = accept(m_listener, NULL, NULL);
+        if (fd < 0) { return; }
+        if (sendAll(fd, &hello[0], hello.size())) {
+            m_worker.push_back(Worker(fd));
+        } else {
+            close(fd);
+        }
+    }
+}
+
+
+int TileCoordinator::dropWorker(size_t w) {
+    const int tile = m_worker[w].tile;
+    close(m_worker[w].fd);
+    m_worker.erase(m_worker.begin() + w);
+    return tile;
+}
+
+
+bool TileCoordinator::receive(size_t w, const std::vector<Tile>& tiles, Framebuffer& image, int& completed) {
+    Worker& worker = m_worker[w];
+
+    unsigned char buffer[65536];
+    const ssize_t n = recv(worker.fd, buffer, sizeof(buffer), MSG_DONTWAIT);
+    if (n == 0) { return false; }
+    if (n < 0) { return (errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINTR); }
+    worker.received.insert(worker.received.end(), buffer, buffer + n);
+
+    while (worker.received.size() >= headerBytes) {
+        const uint32_t type = readWord(&worker.received[0]);
+        const uint32_t length = readWord(&worker.received[4]);
+
+        // Only RESULT is legal, and only for the tile in flight
+        if ((type != RESULT) || (worker.tile < 0)) { return false; }
+        const Tile& tile = tiles[worker.tile];
+        const size_t pixelCount = size_t(tile.width) * tile.height;
+        if (length != 4 + pixelCount * 12) { return false; }
+
+        if (worker.received.size() < headerBytes + length) { return true; }
+
+        const unsigned char* p = &worker.received[headerBytes];
+        if (readWord(p) != worker.tileId) { return false; }
+        p += 4;
+
+        std::vector<Color> row(tile.width);
+        for (int y = 0; y < tile.height; ++y) {
+            for (int x = 0; x < tile.width; ++x, p += 12) {
+                row[x] = Color(readFloat(p), readFloat(p + 4), readFloat(p + 8));
+            }
+            image.setSpan(tile.x, tile.y + y, tile.width, &row[0]);
+        }
+        ++completed;
+        worker.tile = -1;
+        worker.received.erase(worker.received.begin(), worker.received.begin() + headerBytes + length);
+    }
+    return true;
+}
+
+
+bool TileCoordinator::render(const Camera& camera, int tileSize, int pixelSize, int samplesPerPixel, Framebuffer& image) {
+    assert(m_listener >= 0);
+    assert((image.width() == m_imageWidth) && (image.height() == m_imageHeight));
+    assert((tileSize > 0) && (pixelSize > 0));
+
+    // Whole blocks of pixelSize per tile, so that tiles trace the same rays as drawRayCastImage()
+    tileSize = ((tileSize + pixelSize - 1) / pixelSize) * pixelSize;
+
+    std::vector<Tile> tiles;
+    for (int y = 0; y < m_imageHeight; y += tileSize) {
+        for (int x = 0; x < m_imageWidth; x += tileSize) {
+            tiles.push_back(Tile(x, y, min(tileSize, m_imageWidth - x), min(tileSize, m_imageHeight - y), pixelSize, samplesPerPixel));
+        }
+    }
+
+    std::deque<int> queue;
+    for (int i = 0; i < int(tiles.size()); ++i) { queue.push_back(i); }
+    int completed = 0;
+
+    long long lastWorkerMilliseconds = currentMilliseconds();
+    std::vector<unsigned char> message;
+    std::vector<pollfd> fds;
+
+    while (completed < int(tiles.size())) {
+        acceptWorkers();
+
+        // Hand a tile to every idle worker
+        for (size_t w = 0; (w < m_worker.size()) && ! queue.empty(); ) {
+            if (m_worker[w].tile >= 0) { ++w; continue; }
+
+            const int t = queue.front();
+            queue.pop_front();
+            const Tile& tile = tiles[t];
+
+            beginMessage(message, TILE, 40);
+            appendWord(message, m_nextTileId);
+            appendWord(message, uint32_t(tile.x));
+            appendWord(message, uint32_t(tile.y));
+            appendWord(message, uint32_t(tile.width));
+            appendWord(message, uint32_t(tile.height));
+            appendWord(message, uint32_t(tile.pixelSize));
+            appendWord(message, uint32_t(tile.samplesPerPixel));
+            appendFloat(message, camera.yaw);
+            appendFloat(message, camera.pitch);
+            appendFloat(message, camera.zoom);
+
+            m_worker[w].tile = t;
+            m_worker[w].tileId = m_nextTileId++;
+            m_worker[w].sentMilliseconds = currentMilliseconds();
+            if (sendAll(m_worker[w].fd, &message[0], message.size())) {
+                ++w;
+            } else {
+                queue.push_front(dropWorker(w));
+            }
+        }
+
+        // Wait for results or new workers
+        fds.clear();
+        pollfd listener = {m_listener, POLLIN, 0};
+        fds.push_back(listener);
+        for (size_t w = 0; w < m_worker.size(); ++w) {
+            pollfd p = {m_worker[w].fd, POLLIN, 0};
+            fds.push_back(p);
+        }
+        if ((poll(&fds[0], fds.size(), 100) < 0) && (errno != EINTR)) { return false; }
+
+        // Iterate backwards so that dropping a worker does not disturb the indices still to visit
+        const long long now = currentMilliseconds();
+        for (size_t w = m_worker.size(); w-- > 0; ) {
+            bool lost = false;
+            if (fds[w + 1].revents & (POLLIN | POLLHUP | POLLERR)) {
+                lost = ! receive(w, tiles, image, completed);
+            }
+            if (! lost && (m_worker[w].tile >= 0) && (now - m_worker[w].sentMilliseconds > m_tileTimeoutSeconds * 1000LL)) {
+                lost = true;
+            }
+            if (lost) {
+                const int t = dropWorker(w);
+                if (t >= 0) {
+                    fprintf(stderr, "Lost a worker; reissuing tile at (%d, %d)\n", tiles[t].x, tiles[t].y);
+                    queue.push_front(t);
+                }
+            }
+        }
+
+        if (! m_worker.empty()) {
+            lastWorkerMilliseconds = now;
+        } else if (now - lastWorkerMilliseconds > m_idleTimeoutSeconds * 1000LL) {
+            return false;
+        }
+    }
+    return true;
+}
+
+////////////////////////////////////////////////////////////
+
+TileWorker::TileWorker() : m_fd(-1), m_imageWidth(0), m_imageHeight(0) {}
+
+
+TileWorker::~TileWorker() {
+    if (m_fd >= 0) { close(m_fd); }
+}
+
+
+bool TileWorker::connect(const std::string& address) {
+    assert(m_fd < 0);
+    std::string ignore;
+    m_fd = openSocket(address, false, ignore);
+    if (m_fd < 0) { return false; }
+
+    unsigned char hello[headerBytes + 8];
+    if (! receiveAll(m_fd, hello, sizeof(hello)) ||
+        (readWord(hello) != TileCoordinator::HELLO) || (readWord(hello + 4) != 8)) {
+        return false;
+    }
+    m_imageWidth = int(readWord(hello + 8));
+    m_imageHeight = int(readWord(hello + 12));
+    return (m_imageWidth > 0) && (m_imageHeight > 0);
+}
+
+
+bool TileWorker::serve(App& app) {
+    assert(m_fd >= 0);
+    std::vector<Color> pixels;
+    std::vector<unsigned char> result;
+
+    while (true) {
+        unsigned char header[headerBytes];
+        if (! receiveAll(m_fd, header, sizeof(header))) { return false; }
+        const uint32_t type = readWord(header);
+        const uint32_t length = readWord(header + 4);
+        if (length > maxControlBytes) { return false; }
+
+        unsigned char payload[maxControlBytes];
+        if (! receiveAll(m_fd, payload, length)) { return false; }
+
+        if (type == TileCoordinator::QUIT) {
+            return true;
+        } else if ((type != TileCoordinator::TILE) || (length != 40)) {
+            return false;
+        }
+
+        const uint32_t id = readWord(payload);
+        const Tile tile(int(readWord(payload + 4)), int(readWord(payload + 8)), int(readWord(payload + 12)), int(readWord(payload + 16)),
+                        int(readWord(payload + 20)), int(readWord(payload + 24)));
+        const Camera camera(readFloat(payload + 28), readFloat(payload + 32), readFloat(payload + 36));
+
+        if ((tile.width <= 0) || (tile.height <= 0) || (tile.x < 0) || (tile.y < 0) ||
+            (tile.x + tile.width > m_imageWidth) || (tile.y + tile.height > m_imageHeight) || (tile.pixelSize <= 0)) {
+            return false;
+        }
+
+        pixels.assign(size_t(tile.width) * tile.height, Color::black());
+        app.renderTile(camera, tile, &pixels[0]);
+
+        beginMessage(result, TileCoordinator::RESULT, 4 + pixels.size() * 12);
+        appendWord(result, id);
+        for (size_t i = 0; i < pixels.size(); ++i) {
+            appendFloat(result, pixels[i].r);
+            appendFloat(result, pixels[i].g);
+            appendFloat(result, pixels[i].b);
+        }
+        if (! sendAll(m_fd, &result[0], result.size())) { return false; }
+    }
+}
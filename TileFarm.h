@@ -0,0 +1,142 @@
+// Bryan Jones and Melanie Subbiah (2014)
+// All rights reserved
+
+#ifndef TileFarm_h
+#define TileFarm_h
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include "App.h"
+
+class Framebuffer;
+
+/* Rendering an image across several processes, possibly on several hosts.
+
+   A coordinator listens on an address and splits each image into tiles.
+   Worker processes connect to it, learn the image size, and trace one
+   tile at a time with App::renderTile(). The coordinator copies the
+   returned pixels into place. If a worker disconnects, fails to answer,
+   or breaks the protocol, the coordinator drops it and issues its tile to
+   another worker. Workers may join at any time.
+
+   Addresses are either "host:port" for TCP (host may be empty to listen
+   on every interface) or "unix:path" for a Unix domain socket, which is
+   convenient for several workers on one host.
+
+   Messages are a type and a payload length followed by the payload, all
+   as 32-bit big-endian words, so hosts of either byte order may mix:
+
+       HELLO   coordinator -> worker  width, height
+       TILE    coordinator -> worker  id, x, y, width, height, pixelSize,
+                                      samplesPerPixel, yaw, pitch, zoom
+       RESULT  worker -> coordinator  id, then width * height r, g, b floats
+       QUIT    coordinator -> worker  (empty)
+
+   Floats are sent as their IEEE 754 bits. */
+
+/** The coordinator side. Not thread safe. */
+class TileCoordinator {
+public:
+
+    enum MessageType { HELLO = 1, TILE, RESULT, QUIT };
+
+private:
+
+    class Worker {
+    public:
+        int                 fd;
+
+        /* Index of the tile in flight, or -1 if idle */
+        int                 tile;
+
+        /* The id sent with that tile, which the result must carry */
+        uint32_t            tileId;
+
+        /* When the tile was sent, in milliseconds */
+        long long           sentMilliseconds;
+
+        /* Bytes received that do not yet form a whole message */
+        std::vector<unsigned char> received;
+
+        explicit Worker(int fd) : fd(fd), tile(-1), tileId(0), sentMilliseconds(0) {}
+    };
+
+    const int               m_imageWidth;
+    const int               m_imageHeight;
+
+    /* Listening socket, or -1 */
+    int                     m_listener;
+
+    /* Path to unlink for a Unix domain socket */
+    std::string             m_socketPath;
+
+    std::vector<Worker>     m_worker;
+
+    const int               m_tileTimeoutSeconds;
+    const int               m_idleTimeoutSeconds;
+
+    /* Incremented for each tile issued */
+    uint32_t                m_nextTileId;
+
+    /* Accepts every pending connection and greets it with HELLO */
+    void acceptWorkers();
+
+    /* Closes the connection of m_worker[w] and removes it. Returns its tile, or -1. */
+    int dropWorker(size_t w);
+
+    /* Reads what worker w has sent. Completed tiles are copied into image and
+       counted in completed. Returns false if the connection failed or the
+       worker broke the protocol. */
+    bool receive(size_t w, const std::vector<Tile>& tiles, Framebuffer& image, int& completed);
+
+public:
+
+    /** tileTimeoutSeconds bounds the time that one worker may spend on a
+        tile before it is presumed lost. render() gives up after
+        idleTimeoutSeconds without any connected worker. */
+    TileCoordinator(int imageWidth, int imageHeight, int tileTimeoutSeconds = 120, int idleTimeoutSeconds = 60);
+
+    /** Sends QUIT to the workers and closes the sockets */
+    ~TileCoordinator();
+
+    /** Returns false if the address is malformed or cannot be bound */
+    bool listen(const std::string& address);
+
+    int workerCount() const { return int(m_worker.size()); }
+
+    /** Renders camera's view into image, which must be the size given
+        to the constructor, in tiles of at most tileSize x tileSize
+        pixels. Blocks until every tile has arrived. Returns false if
+        there were no workers for idleTimeoutSeconds. */
+    bool render(const Camera& camera, int tileSize, int pixelSize, int samplesPerPixel, Framebuffer& image);
+};
+
+
+/** The worker side */
+class TileWorker {
+private:
+
+    int                     m_fd;
+    int                     m_imageWidth;
+    int                     m_imageHeight;
+
+public:
+
+    TileWorker();
+    ~TileWorker();
+
+    /** Connects to the coordinator and waits for its HELLO. Returns false on failure. */
+    bool connect(const std::string& address);
+
+    /* Valid after connect() */
+    int imageWidth() const { return m_imageWidth; }
+    int imageHeight() const { return m_imageHeight; }
+
+    /** Renders tiles with app, which must be imageWidth() x imageHeight(),
+        until the coordinator sends QUIT (returns true) or the connection
+        fails (returns false). */
+    bool serve(App& app);
+};
+
+#endif
@@ -1,12 +1,101 @@
 #include "Search.h"
 #include "App.h"
+#include "TileFarm.h"
+#include "Animation.h"
+#include "CpuDispatch.h"
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
-int main(const int argc, const char* argv[]) {
+static int usage(const char* program) {
+  fprintf(stderr, "Usage: %s [--isa generic|sse4|avx2|avx512] [width height] [--coordinate address image]\n"
+                  "       %s [--isa ...] [width height] --animate frames output [track]\n"
+                  "       %s [--isa ...] --work address\n", program, program, program);
+  return 1;
+}
+
+int main(int argc, const char* argv[]) {
   printf("17mss3, Melanie Subbiah, mss3@williams.edu\n16bcj2, Bryan Jones, bcj2@williams.edu\n");
   std::string caption = "Masterpiece";
+
+  //The fastest kernels this processor supports are used unless --isa picks others
+  if( argc >= 3 && strcmp(argv[1], "--isa") == 0 ) {
+    if( ! CpuDispatch::select(argv[2]) ) {
+      fprintf(stderr, "Unknown or unsupported kernels %s; this processor supports up to %s\n", argv[2], CpuDispatch::name(CpuDispatch::detect()));
+      return 1;
+    }
+    //Shift the remaining arguments down so that argv[0] stays the program name
+    for( int i = 3; i <= argc; ++i) {
+      argv[i - 2] = argv[i];
+    }
+    argc -= 2;
+  }
+  printf("Using the %s kernels\n", CpuDispatch::name(CpuDispatch::active()));
+
+  //A worker renders tiles for a coordinator, which tells it the image size
+  if( argc == 3 && strcmp(argv[1], "--work") == 0 ) {
+    TileWorker worker;
+    if( ! worker.connect(argv[2]) ) {
+      fprintf(stderr, "Could not reach a coordinator at %s\n", argv[2]);
+      return 1;
+    }
+    Search masterpiece(caption, worker.imageWidth(), worker.imageHeight());
+    return worker.serve(masterpiece) ? 0 : 1;
+  }
+
   //It is better to provide a window with even dimensions
-  Search masterpiece(caption, 100, 100);
-  masterpiece.run();
+  //Usage: rootfinder [width height] [--coordinate address image | --animate frames output [track]]
+  int width = 100, height = 100;
+  int arg = 1;
+  if( argc >= 3 && argv[1][0] != '-' ) {
+    width = atoi(argv[1]);
+    height = atoi(argv[2]);
+    arg = 3;
+  }
+  if( width <= 0 || height <= 0 ) {
+    return usage(argv[0]);
+  }
+
+  Search masterpiece(caption, width, height);
+  if( arg == argc ) {
+    masterpiece.run();
+    return 0;
+  }
+
+  //Render a sequence on every core and write it as a .y4m video or numbered images, such as frame%04d.png.
+  //Without a track file the default view turns once around the vertical axis.
+  if( strcmp(argv[arg], "--animate") == 0 && (argc == arg + 3 || argc == arg + 4) ) {
+    const int frames = atoi(argv[arg + 1]);
+    if( frames <= 0 ) {
+      return usage(argv[0]);
+    }
+    ParameterTrack track;
+    if( argc == arg + 3 ) {
+      track = ParameterTrack::turntable(frames, FrameParameters(0.5f, 0.5f, 0.5f, 6.0f, 3.0f));
+    } else if( ! track.load(argv[arg + 3]) ) {
+      fprintf(stderr, "Could not read the track %s\n", argv[arg + 3]);
+      return 1;
+    }
+    if( ! masterpiece.renderAnimation(track, frames, argv[arg + 2]) ) {
+      fprintf(stderr, "Could not write %s\n", argv[arg + 2]);
+      return 1;
+    }
+    return 0;
+  }
+
+  //Spread the full-quality image over worker processes and save it without opening a window
+  if( argc != arg + 3 || strcmp(argv[arg], "--coordinate") != 0 ) {
+    return usage(argv[0]);
+  }
+  TileCoordinator coordinator(width, height);
+  if( ! coordinator.listen(argv[arg + 1]) ) {
+    fprintf(stderr, "Could not listen on %s\n", argv[arg + 1]);
+    return 1;
+  }
+  if( ! masterpiece.renderOnWorkers(coordinator) ) {
+    fprintf(stderr, "No workers connected\n");
+    return 1;
+  }
+  masterpiece.saveImage(argv[arg + 2]);
   return 0;
 }
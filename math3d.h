@@ -5,6 +5,7 @@
 
 #include <cmath>
 #include <algorithm>
+#include <vector>
 
 using std::min;
 using std::max;
@@ -177,32 +178,18 @@ class Matrix3x3 {
   }
 
   Matrix3x3 operator*(const Matrix3x3& M) const {
-
+    // Unrolled so that each row of the product is three
+    // multiply-adds on the rows of M
     Matrix3x3 C;
-
-
-
     for (int r = 0; r < 3; ++r) {
-
-      for (int c = 0; c < 3; ++c) {
-
-	C.element[r][c] = 0.0f;
-
-	for (int i = 0; i < 3; ++i) {
-
-	  C.element[r][c] += element[r][i] * M.element[i][c];
-
-	}
-
-      }
-
+      const float a = element[r][0], b = element[r][1], c = element[r][2];
+      C.element[r][0] = a * M.element[0][0] + b * M.element[1][0] + c * M.element[2][0];
+      C.element[r][1] = a * M.element[0][1] + b * M.element[1][1] + c * M.element[2][1];
+      C.element[r][2] = a * M.element[0][2] + b * M.element[1][2] + c * M.element[2][2];
     }
-
-
-
     return C;
-
   }
+
   Vector3 operator*(const Vector3& v) const {
     return Vector3(element[0][0] * v.x + element[0][1] * v.y + element[0][2] * v.z,
 		   element[1][0] * v.x + element[1][1] * v.y + element[1][2] * v.z,
@@ -325,6 +312,398 @@ typedef Vector3 Point3;
 typedef Vector2 Point2;
 
 
+/* Eight-wide structure-of-arrays versions of the types above, for
+   processing eight points or colors at once. Every operation is a
+   loop over the lanes with a fixed trip count, which the compiler
+   turns into SIMD instructions (two SSE or one AVX instruction per
+   operation) without intrinsics. */
+static const int SIMD_WIDTH = 8;
+
+class Float8 {
+ public:
+  float lane[SIMD_WIDTH];
+
+  /* Uninitialized, unlike Vector3, so that temporaries cost nothing */
+  Float8() {}
+
+  /* Every lane is k */
+  explicit Float8(float k) {
+    for (int i = 0; i < SIMD_WIDTH; ++i) { lane[i] = k; }
+  }
+
+  /* Reads SIMD_WIDTH consecutive floats */
+  static Float8 load(const float* p) {
+    Float8 a;
+    for (int i = 0; i < SIMD_WIDTH; ++i) { a.lane[i] = p[i]; }
+    return a;
+  }
+
+  void store(float* p) const {
+    for (int i = 0; i < SIMD_WIDTH; ++i) { p[i] = lane[i]; }
+  }
+
+  float operator[](int i) const {
+    return lane[i];
+  }
+
+  float& operator[](int i) {
+    return lane[i];
+  }
+
+  Float8 operator+(const Float8& b) const {
+    Float8 a;
+    for (int i = 0; i < SIMD_WIDTH; ++i) { a.lane[i] = lane[i] + b.lane[i]; }
+    return a;
+  }
+
+  Float8 operator+(float k) const {
+    Float8 a;
+    for (int i = 0; i < SIMD_WIDTH; ++i) { a.lane[i] = lane[i] + k; }
+    return a;
+  }
+
+  Float8 operator-(const Float8& b) const {
+    Float8 a;
+    for (int i = 0; i < SIMD_WIDTH; ++i) { a.lane[i] = lane[i] - b.lane[i]; }
+    return a;
+  }
+
+  Float8 operator-(float k) const {
+    Float8 a;
+    for (int i = 0; i < SIMD_WIDTH; ++i) { a.lane[i] = lane[i] - k; }
+    return a;
+  }
+
+  Float8 operator*(const Float8& b) const {
+    Float8 a;
+    for (int i = 0; i < SIMD_WIDTH; ++i) { a.lane[i] = lane[i] * b.lane[i]; }
+    return a;
+  }
+
+  Float8 operator*(float k) const {
+    Float8 a;
+    for (int i = 0; i < SIMD_WIDTH; ++i) { a.lane[i] = lane[i] * k; }
+    return a;
+  }
+
+  Float8 operator/(const Float8& b) const {
+    Float8 a;
+    for (int i = 0; i < SIMD_WIDTH; ++i) { a.lane[i] = lane[i] / b.lane[i]; }
+    return a;
+  }
+
+  Float8 operator/(float k) const {
+    Float8 a;
+    for (int i = 0; i < SIMD_WIDTH; ++i) { a.lane[i] = lane[i] / k; }
+    return a;
+  }
+};
+
+
+inline Float8 operator*(float k, const Float8& a) {
+  return a * k;
+}
+
+
+inline Float8 operator/(float k, const Float8& a) {
+  return Float8(k) / a;
+}
+
+
+inline Float8 sqrt(const Float8& a) {
+  Float8 b;
+  for (int i = 0; i < SIMD_WIDTH; ++i) { b.lane[i] = std::sqrt(a.lane[i]); }
+  return b;
+}
+
+
+inline Float8 min(const Float8& a, const Float8& b) {
+  Float8 c;
+  for (int i = 0; i < SIMD_WIDTH; ++i) { c.lane[i] = (a.lane[i] < b.lane[i]) ? a.lane[i] : b.lane[i]; }
+  return c;
+}
+
+
+inline Float8 max(const Float8& a, const Float8& b) {
+  Float8 c;
+  for (int i = 0; i < SIMD_WIDTH; ++i) { c.lane[i] = (a.lane[i] > b.lane[i]) ? a.lane[i] : b.lane[i]; }
+  return c;
+}
+
+
+inline Float8 abs(const Float8& a) {
+  Float8 b;
+  for (int i = 0; i < SIMD_WIDTH; ++i) { b.lane[i] = std::fabs(a.lane[i]); }
+  return b;
+}
+
+
+/* SIMD_WIDTH Vector3s, stored as one Float8 per component */
+class Vector3x8 {
+ public:
+  Float8 x, y, z;
+
+  Vector3x8() {}
+
+  Vector3x8(const Float8& x, const Float8& y, const Float8& z) : x(x), y(y), z(z) {}
+
+  /* Every lane is v */
+  explicit Vector3x8(const Vector3& v) : x(v.x), y(v.y), z(v.z) {}
+
+  /* Reads SIMD_WIDTH consecutive Vector3s */
+  static Vector3x8 load(const Vector3* v) {
+    Vector3x8 a;
+    for (int i = 0; i < SIMD_WIDTH; ++i) { a.set(i, v[i]); }
+    return a;
+  }
+
+  /* Reads count <= SIMD_WIDTH consecutive Vector3s. Unused lanes are zero. */
+  static Vector3x8 load(const Vector3* v, int count) {
+    Vector3x8 a(Vector3(0.0f, 0.0f, 0.0f));
+    for (int i = 0; i < count; ++i) { a.set(i, v[i]); }
+    return a;
+  }
+
+  void store(Vector3* v) const {
+    for (int i = 0; i < SIMD_WIDTH; ++i) { v[i] = (*this)[i]; }
+  }
+
+  void store(Vector3* v, int count) const {
+    for (int i = 0; i < count; ++i) { v[i] = (*this)[i]; }
+  }
+
+  Vector3 operator[](int i) const {
+    return Vector3(x.lane[i], y.lane[i], z.lane[i]);
+  }
+
+  void set(int i, const Vector3& v) {
+    x.lane[i] = v.x; y.lane[i] = v.y; z.lane[i] = v.z;
+  }
+
+  Vector3x8 operator*(float k) const {
+    return Vector3x8(x * k, y * k, z * k);
+  }
+
+  Vector3x8 operator/(float k) const {
+    return Vector3x8(x / k, y / k, z / k);
+  }
+
+  /* Scales lane i by k[i] */
+  Vector3x8 operator*(const Float8& k) const {
+    return Vector3x8(x * k, y * k, z * k);
+  }
+
+  Vector3x8 operator/(const Float8& k) const {
+    return Vector3x8(x / k, y / k, z / k);
+  }
+
+  Vector3x8 operator*(const Vector3x8& v) const {
+    return Vector3x8(x * v.x, y * v.y, z * v.z);
+  }
+
+  Vector3x8 operator/(const Vector3x8& v) const {
+    return Vector3x8(x / v.x, y / v.y, z / v.z);
+  }
+
+  Vector3x8 operator+(const Vector3x8& P) const {
+    return Vector3x8(x + P.x, y + P.y, z + P.z);
+  }
+
+  Vector3x8 operator-(const Vector3x8& P) const {
+    return Vector3x8(x - P.x, y - P.y, z - P.z);
+  }
+};
+
+typedef Vector3x8 Point3x8;
+
+
+/* SIMD_WIDTH Colors, stored as one Float8 per channel */
+class Color8 {
+ public:
+  Float8 r, g, b;
+
+  Color8() {}
+
+  Color8(const Float8& r, const Float8& g, const Float8& b) : r(r), g(g), b(b) {}
+
+  /* Every lane is c */
+  explicit Color8(const Color& c) : r(c.r), g(c.g), b(c.b) {}
+
+  static Color8 load(const Color* c) {
+    Color8 a;
+    for (int i = 0; i < SIMD_WIDTH; ++i) { a.set(i, c[i]); }
+    return a;
+  }
+
+  /* Reads count <= SIMD_WIDTH consecutive Colors. Unused lanes are zero. */
+  static Color8 load(const Color* c, int count) {
+    Color8 a(Color(0.0f, 0.0f, 0.0f));
+    for (int i = 0; i < count; ++i) { a.set(i, c[i]); }
+    return a;
+  }
+
+  void store(Color* c) const {
+    for (int i = 0; i < SIMD_WIDTH; ++i) { c[i] = (*this)[i]; }
+  }
+
+  void store(Color* c, int count) const {
+    for (int i = 0; i < count; ++i) { c[i] = (*this)[i]; }
+  }
+
+  Color operator[](int i) const {
+    return Color(r.lane[i], g.lane[i], b.lane[i]);
+  }
+
+  void set(int i, const Color& c) {
+    r.lane[i] = c.r; g.lane[i] = c.g; b.lane[i] = c.b;
+  }
+
+  Color8 operator*(float k) const {
+    return Color8(r * k, g * k, b * k);
+  }
+
+  Color8 operator/(float k) const {
+    return Color8(r / k, g / k, b / k);
+  }
+
+  Color8 operator*(const Float8& k) const {
+    return Color8(r * k, g * k, b * k);
+  }
+
+  Color8 operator*(const Color8& c) const {
+    return Color8(r * c.r, g * c.g, b * c.b);
+  }
+
+  Color8 operator/(const Color8& c) const {
+    return Color8(r / c.r, g / c.g, b / c.b);
+  }
+
+  Color8 operator+(const Color8& c) const {
+    return Color8(r + c.r, g + c.g, b + c.b);
+  }
+
+  Color8 operator-(const Color8& c) const {
+    return Color8(r - c.r, g - c.g, b - c.b);
+  }
+};
+
+
+inline Vector3x8 operator*(float f, const Vector3x8& v) {
+  return v * f;
+}
+
+
+inline Color8 operator*(float f, const Color8& c) {
+  return c * f;
+}
+
+
+inline Vector3x8 max(const Vector3x8& a, const Vector3x8& b) {
+  return Vector3x8(max(a.x, b.x), max(a.y, b.y), max(a.z, b.z));
+}
+
+
+inline Vector3x8 abs(const Vector3x8& a) {
+  return Vector3x8(abs(a.x), abs(a.y), abs(a.z));
+}
+
+
+inline Color8 sqrt(const Color8& c) {
+  return Color8(sqrt(c.r), sqrt(c.g), sqrt(c.b));
+}
+
+
+/* Computes the dot (inner) product of each lane */
+inline Float8 dot(const Vector3x8& a, const Vector3x8& v) {
+  Float8 d;
+  for (int i = 0; i < SIMD_WIDTH; ++i) {
+    d.lane[i] = a.x.lane[i] * v.x.lane[i] + a.y.lane[i] * v.y.lane[i] + a.z.lane[i] * v.z.lane[i];
+  }
+  return d;
+}
+
+
+/* Computes the dot (inner) product of each lane */
+inline Float8 dot(const Color8& a, const Color8& c) {
+  Float8 d;
+  for (int i = 0; i < SIMD_WIDTH; ++i) {
+    d.lane[i] = a.r.lane[i] * c.r.lane[i] + a.g.lane[i] * c.g.lane[i] + a.b.lane[i] * c.b.lane[i];
+  }
+  return d;
+}
+
+
+/* Vector magnitude of each lane. Overloads the template above, which returns a float. */
+inline Float8 length(const Vector3x8& v) {
+  return sqrt(dot(v, v));
+}
+
+
+inline Vector3x8 normalize(const Vector3x8& v) {
+  Vector3x8 n;
+  for (int i = 0; i < SIMD_WIDTH; ++i) {
+    const float k = 1.0f / std::sqrt(v.x.lane[i] * v.x.lane[i] + v.y.lane[i] * v.y.lane[i] + v.z.lane[i] * v.z.lane[i]);
+    n.x.lane[i] = v.x.lane[i] * k;
+    n.y.lane[i] = v.y.lane[i] * k;
+    n.z.lane[i] = v.z.lane[i] * k;
+  }
+  return n;
+}
+
+
+inline Vector3x8 mix(const Vector3x8& a, const Vector3x8& b, const Float8& t) {
+  return a + (b - a) * t;
+}
+
+
+inline Color8 mix(const Color8& a, const Color8& b, const Float8& t) {
+  return Color8(a.r + (b.r - a.r) * t, a.g + (b.g - a.g) * t, a.b + (b.b - a.b) * t);
+}
+
+
+/* Multiplies every lane by M. The elements are read once and broadcast. */
+inline Vector3x8 operator*(const Matrix3x3& M, const Vector3x8& v) {
+  const float m00 = M.element[0][0], m01 = M.element[0][1], m02 = M.element[0][2];
+  const float m10 = M.element[1][0], m11 = M.element[1][1], m12 = M.element[1][2];
+  const float m20 = M.element[2][0], m21 = M.element[2][1], m22 = M.element[2][2];
+  Vector3x8 r;
+  for (int i = 0; i < SIMD_WIDTH; ++i) {
+    const float x = v.x.lane[i], y = v.y.lane[i], z = v.z.lane[i];
+    r.x.lane[i] = m00 * x + m01 * y + m02 * z;
+    r.y.lane[i] = m10 * x + m11 * y + m12 * z;
+    r.z.lane[i] = m20 * x + m21 * y + m22 * z;
+  }
+  return r;
+}
+
+
+/* Batch operations over arrays of blockCount SIMD blocks. out may be the same array as in.
+   Data should stay in this form between operations: converting arrays of Vector3 with load()
+   and store() costs more than the SIMD arithmetic saves on operations this small. */
+
+/* out[i] = M * in[i] */
+inline void transform(const Matrix3x3& M, const Vector3x8* in, Vector3x8* out, int blockCount) {
+  for (int i = 0; i < blockCount; ++i) {
+    out[i] = M * in[i];
+  }
+}
+
+
+/* out[i] = normalize(in[i]) */
+inline void normalize(const Vector3x8* in, Vector3x8* out, int blockCount) {
+  for (int i = 0; i < blockCount; ++i) {
+    out[i] = normalize(in[i]);
+  }
+}
+
+
+/* out[i] = dot(a[i], b[i]) */
+inline void dot(const Vector3x8* a, const Vector3x8* b, Float8* out, int blockCount) {
+  for (int i = 0; i < blockCount; ++i) {
+    out[i] = dot(a[i], b[i]);
+  }
+}
+
 /* Base class for distance functions like Mandelbulb */
 class Shape {
  protected:
@@ -338,6 +717,12 @@ class Shape {
      and a 0 <= shade <= 1 that is lower in cracks and higher at ridges.  */
   virtual void getDistanceAndShade(const Point3& point, float& distance, float& shade) const = 0;
 
+  /* Like getDistanceAndShade(), but detail smaller than footprint, the radius of the
+     region that one pixel covers around point, may be left out. 0 asks for full detail. */
+  virtual void getCoarseDistanceAndShade(const Point3& point, float footprint, float& distance, float& shade) const {
+    getDistanceAndShade(point, distance, shade);
+  }
+
   // Objects that can have subclasses must have virtual destructors in C++
   virtual ~Shape() {}
   virtual float distance(const Point3& point) const;
@@ -351,21 +736,158 @@ class Function {
  public:
   virtual ~Function() {}
   virtual float operator()(float x) const = 0;
+
+  /* Computes y[i] = f(x[i]) for count values with one virtual call.
+     Override with a loop the compiler can vectorize. */
+  virtual void evaluate(const float* x, float* y, int count) const {
+    for (int i = 0; i < count; ++i) {
+      y[i] = (*this)(x[i]);
+    }
+  }
+};
+
+/** A real polynomial c[0] + c[1] x + ... + c[n] x^n */
+class Polynomial : public Function {
+ protected:
+  std::vector<float> coefficient;
+
+  /* Leading zeros would make degree() overstate the degree */
+  void trim() {
+    while (coefficient.size() > 1 && coefficient.back() == 0.0f) {
+      coefficient.pop_back();
+    }
+  }
+
+ public:
+
+  /* Coefficients are listed from the constant term up */
+  explicit Polynomial(const std::vector<float>& c) : coefficient(c) {
+    if (coefficient.empty()) { coefficient.push_back(0.0f); }
+    trim();
+  }
+
+  int degree() const {
+    return int(coefficient.size()) - 1;
+  }
+
+  float operator[](int i) const {
+    return coefficient[i];
+  }
+
+  /* Horner's rule */
+  virtual float operator()(float x) const override {
+    float y = coefficient.back();
+    for (int i = degree() - 1; i >= 0; --i) {
+      y = y * x + coefficient[i];
+    }
+    return y;
+  }
+
+  virtual void evaluate(const float* x, float* y, int count) const override {
+    const int n = degree();
+    for (int j = 0; j < count; ++j) {
+      y[j] = coefficient[n];
+    }
+    for (int i = n - 1; i >= 0; --i) {
+      const float c = coefficient[i];
+      for (int j = 0; j < count; ++j) {
+        y[j] = y[j] * x[j] + c;
+      }
+    }
+  }
+
+  /* Room for coefficients up to maxDegree, so that derivativeInto and
+     deflateInto do not allocate when writing to this polynomial */
+  void reserve(int maxDegree) {
+    coefficient.reserve(maxDegree + 1);
+  }
+
+  Polynomial derivative() const {
+    Polynomial d(*this);
+    derivativeInto(d);
+    return d;
+  }
+
+  /* Writes the derivative to out, reusing its storage. out may be this polynomial. */
+  void derivativeInto(Polynomial& out) const {
+    const int n = degree();
+    std::vector<float>& d = out.coefficient;
+    if (n < 1) {
+      d.assign(1, 0.0f);
+      return;
+    }
+    if (&out != this) { d.resize(n); }
+    for (int i = 1; i <= n; ++i) {
+      d[i - 1] = coefficient[i] * float(i);
+    }
+    d.resize(n);
+    out.trim();
+  }
+
+  /* Divides by (x - root) with synthetic division and drops the
+     remainder, which is f(root). The quotient has one lower degree. */
+  Polynomial deflate(float root) const {
+    Polynomial q(*this);
+    deflateInto(root, q);
+    return q;
+  }
+
+  /* As deflate, but writes the quotient to out, reusing its storage. out may be this polynomial. */
+  void deflateInto(float root, Polynomial& out) const {
+    const int n = degree();
+    if (n < 1) {
+      out.coefficient = coefficient;
+      return;
+    }
+    std::vector<float>& q = out.coefficient;
+    if (&out != this) { q.resize(n); }
+    float carry = coefficient[n];
+    for (int i = n - 1; i >= 0; --i) {
+      const float c = coefficient[i];
+      q[i] = carry;
+      carry = carry * root + c;
+    }
+    q.resize(n);
+    out.trim();
+  }
 };
 
 /** A generic real quadratic function */
-class Quadratic : public Function {
+class Quadratic : public Polynomial {
  protected:
   float a, b, c;
 
  public:
 
- Quadratic(float a, float b, float c) : a(a), b(b), c(c) {}
+ Quadratic(float a, float b, float c) : Polynomial(std::vector<float>{c, b, a}), a(a), b(b), c(c) {}
 
   virtual float operator()(float x) const override {
     return a * x * x + b * x + c;
   }
 
+  virtual void evaluate(const float* x, float* y, int count) const override {
+    for (int i = 0; i < count; ++i) {
+      y[i] = (a * x[i] + b) * x[i] + c;
+    }
+  }
+
+};
+
+
+/** The radius of the cone that one pixel covers along a ray,
+    length(origin + t * growth) at distance t. Zero everywhere by default. */
+class RayFootprint {
+ public:
+  Vector3 origin;
+  Vector3 growth;
+
+ RayFootprint() : origin(0.0f, 0.0f, 0.0f), growth(0.0f, 0.0f, 0.0f) {}
+
+ RayFootprint(const Vector3& origin, const Vector3& growth) : origin(origin), growth(growth) {}
+
+  float radius(float t) const {
+    return length(origin + growth * t);
+  }
 };
 
 
@@ -374,11 +896,47 @@ class DistanceToShapeOnRay : public Function {
   Point3  origin;
   Vector3 direction;
   const Shape&  shape;
+  RayFootprint footprint;
 
  public:
- DistanceToShapeOnRay(const Point3& P, const Vector3& v, const Shape& s) : origin(P), direction(v), shape(s) {}
+ DistanceToShapeOnRay(const Point3& P, const Vector3& v, const Shape& s, const RayFootprint& footprint = RayFootprint()) :
+  origin(P), direction(v), shape(s), footprint(footprint) {}
+
   virtual float operator()(float f) const override {
-    return shape.distance(origin + direction * f);
+    float d, ignore;
+    shape.getCoarseDistanceAndShade(origin + direction * f, footprint.radius(f), d, ignore);
+    return d;
+  }
+};
+
+
+/* Distance from point to shape. When S::getDistanceAndShade is final this is a direct, inlinable call. */
+template <class S>
+inline float distanceToShape(const S& shape, const Point3& point) {
+  float d, ignore;
+  shape.getDistanceAndShade(point, d, ignore);
+  return d;
+}
+
+
+/** DistanceToShapeOnRay for a shape of known type. This is not a Function, so
+    templates that call it pay no virtual call per evaluation. */
+template <class S>
+class StaticDistanceToShapeOnRay {
+ private:
+  Point3  origin;
+  Vector3 direction;
+  const S&  shape;
+  RayFootprint footprint;
+
+ public:
+ StaticDistanceToShapeOnRay(const Point3& P, const Vector3& v, const S& s, const RayFootprint& footprint = RayFootprint()) :
+  origin(P), direction(v), shape(s), footprint(footprint) {}
+
+  float operator()(float f) const {
+    float d, ignore;
+    shape.getCoarseDistanceAndShade(origin + direction * f, footprint.radius(f), d, ignore);
+    return d;
   }
 };
 
@@ -6,100 +6,53 @@
 #include "Mandelbulb.h"
 #include "math3d.h"
 #include "Search.h"
+#include "Raster.h"
+#include "Animation.h"
+#include "Chebyshev.h"
 #include <cassert>
+#include <cfloat>
 #include <cmath>
+#include <algorithm>
 
 //Construct Search using the App constructor
-Search::Search(std::string& windowCaption, int imageWidth, int imageHeight, float zoom, float exposureConstant, float imageGamma) : App(windowCaption, imageWidth, imageHeight, zoom, exposureConstant, imageGamma) {}
-
-//Change the color of a pixel (takes x and y values)
-void Search::setPixel(int x, int y, const Color& c) {
-  setPixel(Vector2(x, y), c);
+Search::Search(std::string& windowCaption, int imageWidth, int imageHeight, float zoom, float exposureConstant, float imageGamma, Framebuffer::Format imageFormat) : App(windowCaption, imageWidth, imageHeight, zoom, exposureConstant, imageGamma, imageFormat) {
+  //Initial view of the Mandelbulb
+  setCamera(Camera(0.5f, 0.5f, 3.0f));
 }
 
-//Change the color of a pixel (takes a Vector2)
-void Search::setPixel(Vector2 point, const Color& c) {
-  m_imageData[m_imageWidth * point.y + point.x] = c;
+//Change the color of a pixel
+void Search::setPixel(int x, int y, const Color& c) {
+  m_framebuffer.set(x, y, c);
+  m_framebuffer.markDirty(y, y);
 }
 
-//Retrieve a pixel (takes x and y values)
+//Retrieve a pixel
 Color Search::pixel(int x, int y) const {
-  return pixel(Vector2(x, y));
-}
-
-//Retrieve a pixel (takes a Vector2)
-Color Search::pixel(Vector2 point) const {
-  return m_imageData[m_imageWidth * point.y + point.x];
+  return m_framebuffer.get(x, y);
 }
 
-//Draws a line (takes x and y values)
+//Draws a line (takes x and y values), clipped to the image
 void Search::drawLine(int x0, int y0, int x1, int y1, const Color& c) {
-  drawLine(Vector2(x0, y0), Vector2(x1, y1), c);
+  rasterizeLine(m_framebuffer, x0, y0, x1, y1, c);
 }
 
 //Draws a line (takes a Vector2)
 void Search::drawLine(Vector2 point0, Vector2 point1, const Color& c) {
-  //Check line endpoints are within display range
-  if(point0.x >= 0 && point0.x < m_imageWidth && point0.y >= 0 && point0.y < m_imageHeight && point1.x >= 0 && point1.x < m_imageWidth && point1.y >= 0 && point1.y < m_imageHeight) {
- 
-    //Draw a vertical line 
-    if(point0.x == point1.x) {
- 
-     //Make sure the second point has a larger y value than the first point
-      if (point0.y > point1.y) {
-	std::swap(point0, point1);
-      }
-      for(int y = point0.y; y <= point1.y; ++y) {
-	setPixel(Vector2(int(point0.x), y), c);
-      }
-
-      //Draw a horizontal line
-    } else {
-
-      //Slope
-      float m = (point1.y - point0.y)/(point1.x - point0.x);
-      
-      //Draw flatter lines
-      if (std::abs(m) < 1) {
-	if (point0.x > point1.x) {
-	  std::swap(point0, point1);
-	}
-	int y = point0.y;
-	for(int x = point0.x; x <= point1.x; ++x, y += m) {
-	  setPixel(Vector2(x, y), c);
-	}
-
-	//Draw steeper lines
-      } else {
-	if (point0.y > point1.y) {
-	  std::swap(point0, point1);
-	}
-	
-	float x = float(point0.x);
-	for(float y = point0.y; y <= point1.y; ++y, x += (1.0/m)) {
-	  setPixel(Vector2(x, y), c);
-	}
-      }
-    }
-  }
+  drawLine(int(point0.x), int(point0.y), int(point1.x), int(point1.y), c);
 }
 
 //Draw a box (takes x and y values for the lower left and upper right corners)
 void Search::drawBox(int x0, int y0, int x1, int y1, const Color& c) {
-  drawBox(Vector2(x0, y0), Vector2(x1, y1), c);
+  //Draw box lines through the remaining corners (x0, y1) and (x1, y0)
+  drawLine(x0, y0, x0, y1, c);
+  drawLine(x0, y1, x1, y1, c);
+  drawLine(x1, y1, x1, y0, c);
+  drawLine(x1, y0, x0, y0, c);
 }
 
 //Draw a box (takes Vector2 values for the lower left and upper right corners)
 void Search::drawBox(Vector2 point0, Vector2 point1, const Color& c) {
-  //Determine remaining corners
-  Vector2 upperLeft = Vector2(point0.x, point1.y);
-  Vector2 lowerRight = Vector2(point1.x, point0.y);
-  
-  //Draw box lines
-  drawLine(point0, upperLeft, c);
-  drawLine(upperLeft, point1, c);
-  drawLine(point1, lowerRight, c);
-  drawLine(lowerRight, point0, c);
+  drawBox(int(point0.x), int(point0.y), int(point1.x), int(point1.y), c);
 }
 
 //Draw axes of graph
@@ -124,94 +77,505 @@ void Search::drawAxes( float hashMarks_x, float hashMarks_y, const Color& c) {
 }
 
 //Plot a function
-void Search::plot( Function& f, float domain_s, float domain_e, float range_s, float range_e, Color c, bool newton) {
+void Search::plot( Function& f, float domain_s, float domain_e, float range_s, float range_e, Color c, bool newton, int oversample) {
+  plot(std::vector<PlotJob>(1, PlotJob(f, c, domain_s, domain_e, range_s, range_e, newton)), oversample);
+}
+
+//Plot several functions
+void Search::plot( const std::vector<PlotJob>& jobs, int oversample) {
+  const int n = int(jobs.size());
+  std::vector< std::vector<ColumnSpan> > spans(n);
+  std::vector< std::vector<float> > roots(n);
+
+  //Each task samples one curve and then finds its roots
+  m_threadPool.parallelFor(n, [&](int i) {
+    const PlotJob& job = jobs[i];
+    SampledFunction samples;
+    sampleCurve(*job.f, job.domain_s, job.domain_e, oversample, spans[i], samples);
+
+    if( job.method == PlotJob::PARALLEL ) {
+      //Searched below, once the pool is free
+    } else if( job.method == PlotJob::CHEBYSHEV ) {
+      findChebyshevRoots(*job.f, job.domain_s, job.domain_e, roots[i]);
+    } else if( !job.newton && dynamic_cast<const Polynomial*>(job.f) != NULL ) {
+      //Polynomials divide out each root as it is found, which does not depend on the samples
+      findRoots(*job.f, job.domain_s, job.domain_e, roots[i]);
+    } else {
+      //Bracket the roots between the plotted samples, then refine them with either binary search or
+      //Newton's method. A step finds at most two roots, so the buffer cannot overflow.
+      roots[i].resize(2 * samples.x.size());
+      RootBuffer buffer(&roots[i][0], int(roots[i].size()));
+      findSampledRoots(*job.f, samples, job.domain_s, job.domain_e, job.newton, buffer);
+      roots[i].resize(buffer.size());
+    }
+  });
 
-  //Convert from pixels to axis values
-  float inc = (domain_e - domain_s) / float(m_imageWidth - 1);
+  //Inside a task these searches would run on one thread
+  for( int i = 0; i < n; ++i) {
+    if( jobs[i].method == PlotJob::PARALLEL ) {
+      findRootsParallel(*jobs[i].f, jobs[i].domain_s, jobs[i].domain_e, roots[i], jobs[i].newton);
+    }
+  }
 
-  //Plot the function by drawing lines from (x, f(x)) to (x+1, f(x+1))
-  for( float i = domain_s; i <= (domain_e); i += inc) { 
-    // x-value is shifted right one pixel to align with axes
-    drawLine(Vector2(int(i/inc + float((m_imageWidth - 1)/2)) + 1, int(float((m_imageHeight - 1)/2) - f(i)/inc)), Vector2(int((i + inc)/inc + float((m_imageWidth - 1)/2)), int(float((m_imageHeight - 1)/2) - f(i + inc)/inc)), c);
+  //Draw all of the curves, then boxes around all of the roots so that they stay visible
+  for( int i = 0; i < n; ++i) {
+    drawSpans(spans[i], jobs[i].color);
+  }
+  for( int i = 0; i < n; ++i) {
+    //Convert from pixels to axis values
+    const float inc = (jobs[i].domain_e - jobs[i].domain_s) / float(m_imageWidth - 1);
+    for( size_t r = 0; r < roots[i].size(); ++r) {
+      Vector2 one(float((m_imageWidth - 1)/2 + roots[i][r]/inc - 3) , float((m_imageHeight - 1)/2) + 3);
+      Vector2 two(float((m_imageWidth - 1)/2 + roots[i][r]/inc + 4) , float((m_imageHeight - 1)/2) - 3);
+
+      drawBox(one, two, Color(0, 250, 250));
+    }
   }
+}
 
-  //Find the roots using linear search and then either binary search or Newton's method
-  std::vector<float> root;
-  if( newton == true ) {
-    findRoots_N(f, domain_s, domain_e, root);
-  } else {
-    findRoots(f, domain_s, domain_e, root);
+//Sample a function for plotting
+void Search::sampleCurve( const Function& f, float domain_s, float domain_e, int oversample, std::vector<ColumnSpan>& spans, SampledFunction& samples) const {
+  assert(oversample >= 1);
+
+  //Convert from pixels to axis values; the x and y axes share a scale
+  const float inc = (domain_e - domain_s) / float(m_imageWidth - 1);
+  const int centerX = (m_imageWidth - 1)/2;
+  const float centerY = float((m_imageHeight - 1)/2);
+
+  //Sample k is at x = (k/oversample - 1 - centerX) * inc, so pixel column c
+  //(shifted right one pixel to align with axes) covers samples c*oversample
+  //through (c+1)*oversample. Neighboring columns share their edge sample,
+  //which keeps the curve connected.
+  const int count = m_imageWidth * oversample + 1;
+  std::vector<float>& x = samples.x;
+  x.resize(count);
+  samples.fx.resize(count);
+  for( int k = 0; k < count; ++k) {
+    x[k] = (float(k) / float(oversample) - 1.0f - float(centerX)) * inc;
   }
 
-  //Draw boxes around the roots
-  while( root.size() > 0) {
-    Vector2 one(float((m_imageWidth - 1)/2 + root.front()/inc - 3) , float((m_imageHeight - 1)/2) + 3);
-    Vector2 two(float((m_imageWidth - 1)/2 + root.front()/inc + 4) , float((m_imageHeight - 1)/2) - 3);
+  //One batch for the whole curve
+  f.evaluate(&x[0], &samples.fx[0], count);
 
-    drawBox(one, two, Color(0, 250, 250));
-    root.erase(root.begin());
+  //Convert to pixel rows, dropping samples outside the domain
+  std::vector<float> y(count);
+  for( int k = 0; k < count; ++k) {
+    y[k] = (x[k] >= domain_s && x[k] <= domain_e) ? centerY - samples.fx[k]/inc : NAN;
+  }
+
+  //The extent of the samples in each column
+  spans.assign(m_imageWidth, ColumnSpan());
+  for( int col = 0; col < m_imageWidth; ++col) {
+    float top = INFINITY;
+    float bottom = -INFINITY;
+    for( int k = col * oversample; k <= (col + 1) * oversample; ++k) {
+      //Comparisons with NaN are false, so undefined samples are skipped
+      if( y[k] < top ) {
+        top = y[k];
+      }
+      if( y[k] > bottom ) {
+        bottom = y[k];
+      }
+    }
+
+    //Clip to the image
+    if( top <= bottom && bottom >= 0.0f && top < float(m_imageHeight) ) {
+      spans[col].top = int(max(std::floor(top), 0.0f));
+      spans[col].bottom = int(min(std::floor(bottom), float(m_imageHeight - 1)));
+    }
   }
 }
 
-//Find roots using coarse linear search and then binary search
-void Search::findRoots( const Function& f, float xMin, float xMax, std::vector<float>& root) const {
-  //Increment for linear search
-  float inc = 0.2f;
-
-  //Use binary search once a potential location for a root is found
-  for( float i = xMin; i <= xMax; i += inc) {
-    if( (f(i) > 0 && f(i + inc) < 0) || (f(i) < 0 && f(i + inc) > 0) ) {
-      root.push_back(binarySearch(f, i, i + inc, 80));
+//Draw the columns of a sampled curve
+void Search::drawSpans( const std::vector<ColumnSpan>& spans, const Color& c) {
+  for( int col = 0; col < int(spans.size()); ++col) {
+    if( spans[col].top <= spans[col].bottom ) {
+      rasterizeVerticalSpan(m_framebuffer, col, spans[col].top, spans[col].bottom, c);
     }
   }
 }
 
+//Find roots using coarse linear search and then binary search
+void Search::findRoots( const Function& f, float xMin, float xMax, RootBuffer& root, RootWorkspace& workspace) const {
+  //Polynomials can divide out each root as it is found
+  const Polynomial* p = dynamic_cast<const Polynomial*>(&f);
+  if( p != NULL ) {
+    findPolynomialRoots(*p, xMin, xMax, root, workspace);
+  } else {
+    scanRoots(f, xMin, xMax, 0.2f, false, false, root);
+  }
+}
+
 //Find roots using Newton's method
 void Search::findRoots_N( const Function& f, float xMin, float xMax, std::vector<float>& root) const {
-  //Increment for linear search
-  float inc = 0.3f;
-
-  //Use Newton's method once a potential location for a root is found
-  for( float i = xMin; i <= xMax; i += inc) {
-    if( (f(i) > 0 && f(i + inc) < 0) || (f(i) < 0 && f(i + inc) > 0) ) {
-      Derivative d(f);
-      root.push_back(newtonSearch(f, d, i));
+  appendRoots(root, [&](RootBuffer& buffer) { findRoots_N(f, xMin, xMax, buffer); });
+}
+
+void Search::findRoots_N( const Function& f, float xMin, float xMax, RootBuffer& root) const {
+  scanRoots(f, xMin, xMax, 0.3f, true, false, root);
+}
+
+//Steps scanRoots takes through [xMin, xMax]
+static int scanStepCount( float xMin, float xMax, float inc) {
+  return (xMax >= xMin) ? int(std::floor((xMax - xMin) / inc)) + 1 : 0;
+}
+
+//Step through [xMin, xMax] by inc, checking each step for roots with scanStep()
+void Search::scanRoots( const Function& f, float xMin, float xMax, float inc, bool newton, bool firstOnly, RootBuffer& root) const {
+  STATS_COUNT(ROOT_SEARCHES);
+  scanSteps(f, xMin, inc, 0, scanStepCount(xMin, xMax, inc), newton, firstOnly, root);
+}
+
+//Step k starts at sample xMin + k*inc. Computing each sample from its index instead of accumulating
+//inc puts the samples in the same place however the steps are divided up.
+void Search::scanSteps( const Function& f, float xMin, float inc, int first, int last, bool newton, bool firstOnly, RootBuffer& root) const {
+  STATS_TIME(SCAN);
+  const int found = root.found();
+
+  //Evaluate each sample once; the right end of one interval is the left end of the next.
+  //The sample before the first step is only needed to spot a minimum of |f| at the first sample.
+  float fPrev = NAN;
+  if( first > 0 ) {
+    fPrev = f(xMin + float(first - 1) * inc);
+    STATS_COUNT(EVALUATIONS);
+  }
+  float fi = f(xMin + float(first) * inc);
+  STATS_COUNT(EVALUATIONS);
+
+  for( int k = first; k < last; ++k) {
+    const float fNext = f(xMin + float(k + 1) * inc);
+    STATS_COUNT(EVALUATIONS);
+    scanStep(f, xMin + float(k - 1) * inc, xMin + float(k) * inc, xMin + float(k + 1) * inc, fPrev, fi, fNext, newton, root);
+
+    if( firstOnly && root.found() > found ) {
+      return;
     }
+    fPrev = fi;
+    fi = fNext;
   }
 }
 
-//Use Newton's method to find a root
-float Search::newtonSearch( const Function& f, const Derivative& d, float x, float err) const {
-  //Calculate the value of the derivative of x
-  float m = d(x);
-  float b = f(x) - m * x;
-  x = -b / m;
+//A sign change between x and xNext is a root; x where |f| is a local minimum without a sign change
+//may hide a root f only touches, or a pair of roots that cancel.
+void Search::scanStep( const Function& f, float xPrev, float x, float xNext, float fPrev, float fx, float fNext, bool newton, RootBuffer& root) const {
+  if( fx == 0 ) {
+    root.push(x);
+  } else if( (fx > 0 && fNext < 0) || (fx < 0 && fNext > 0) ) {
+    STATS_COUNT(BRACKETS);
+    STATS_TIME(REFINE);
+    root.push(refineRoot(f, x, xNext, newton));
+  } else if( (fPrev > 0) == (fx > 0) && (fNext > 0) == (fx > 0) &&
+             std::fabs(fx) < std::fabs(fPrev) && std::fabs(fx) <= std::fabs(fNext) ) {
+    STATS_TIME(REFINE);
+    findTangentialRoots(f, xPrev, xNext, fx, newton, root);
+  }
+}
 
-  //Check whether the point is a zero
-  if( std::abs(f(x)) <= err) {
-    return x;
+//Scan the samples instead of evaluating f on a grid of its own. f is only evaluated to refine the roots.
+void Search::findSampledRoots( const Function& f, const SampledFunction& samples, float xMin, float xMax, bool newton, RootBuffer& root) const {
+  STATS_COUNT(ROOT_SEARCHES);
+  STATS_TIME(SCAN);
+  const std::vector<float>& x = samples.x;
+  const std::vector<float>& fx = samples.fx;
+  assert(x.size() == fx.size());
+
+  //Steps from the last sample at or before xMin to the first at or after xMax cover [xMin, xMax]
+  const int first = max(int(std::upper_bound(x.begin(), x.end(), xMin) - x.begin()) - 1, 0);
+  const int last = min(int(std::lower_bound(x.begin(), x.end(), xMax) - x.begin()), int(x.size()) - 1);
+
+  for( int k = first; k < last; ++k) {
+    //There is no sample before the first, as at the start of scanRoots
+    const float xPrev = (k > 0) ? x[k - 1] : NAN;
+    const float fPrev = (k > 0) ? fx[k - 1] : NAN;
+    scanStep(f, xPrev, x[k], x[k + 1], fPrev, fx[k], fx[k + 1], newton, root);
+  }
+}
+
+//Find roots of one expensive function on all threads. The scan steps are dealt out in chunks,
+//several per thread so that threads that draw cheap chunks take more of them.
+void Search::findRootsParallel( const Function& f, float xMin, float xMax, std::vector<float>& root, bool newton) {
+  //Deflation is sequential, and polynomials are cheap to evaluate anyway
+  if( !newton && dynamic_cast<const Polynomial*>(&f) != NULL ) {
+    findRoots(f, xMin, xMax, root);
+    return;
+  }
+
+  STATS_COUNT(ROOT_SEARCHES);
+  const float inc = newton ? 0.3f : 0.2f;
+  const int steps = scanStepCount(xMin, xMax, inc);
+  if( steps == 0 ) {
+    return;
+  }
+
+  //Each chunk evaluates the sample before its first step and the first sample again, so keep chunks long enough that this is cheap
+  const int minStepsPerChunk = 16;
+  const int chunks = max(1, min(8 * m_threadPool.size(), steps / minStepsPerChunk));
+
+  //A step finds at most two roots, so the buffers never overflow and no chunk is scanned twice
+  std::vector< std::vector<float> > chunkRoot(chunks);
+  m_threadPool.parallelFor(chunks, [&](int c) {
+    const int first = int((long long)steps * c / chunks);
+    const int last = int((long long)steps * (c + 1) / chunks);
+    chunkRoot[c].resize(2 * (last - first));
+    RootBuffer buffer(&chunkRoot[c][0], int(chunkRoot[c].size()));
+    scanSteps(f, xMin, inc, first, last, newton, false, buffer);
+    chunkRoot[c].resize(buffer.size());
+  });
+
+  //A root is reported by the step whose interval holds it, so a root on a chunk boundary is only
+  //found once. Refinement can still land two steps on one root, so merge roots that f stays zero between.
+  const size_t start = root.size();
+  for( int c = 0; c < chunks; ++c) {
+    root.insert(root.end(), chunkRoot[c].begin(), chunkRoot[c].end());
+  }
+  std::sort(root.begin() + start, root.end());
+
+  size_t kept = start;
+  for( size_t r = start; r < root.size(); ++r) {
+    if( kept > start && std::fabs(root[r] - root[kept - 1]) <= 1e-3f ) {
+      STATS_COUNT(EVALUATIONS);
+      if( std::fabs(f((root[r] + root[kept - 1]) / 2.0f)) <= 0.0003f ) {
+        continue;
+      }
+    }
+    root[kept++] = root[r];
+  }
+  root.resize(kept);
+}
+
+//Find roots from a Chebyshev proxy of f, evaluating f only to build the proxy and polish its roots
+void Search::findChebyshevRoots( const Function& f, float xMin, float xMax, std::vector<float>& root) const {
+  const ChebyshevProxy proxy(f, xMin, xMax);
+  if( proxy.converged() ) {
+    STATS_COUNT(ROOT_SEARCHES);
+    proxy.findRoots(f, root);
   } else {
-    return newtonSearch(f, d, x);
+    //f is not smooth enough to approximate, so scan it instead
+    appendRoots(root, [&](RootBuffer& buffer) { scanRoots(f, xMin, xMax, 0.2f, false, false, buffer); });
   }
-} 
+}
+
+//Refine a bracketed root with binary search or Newton's method
+float Search::refineRoot( const Function& f, float xMin, float xMax, bool newton) const {
+  if( newton ) {
+    Derivative d(f);
+    return newtonSearch(f, d, xMin, xMax).x;
+  }
+  return binarySearch(f, xMin, xMax, 80);
+}
+
+//f has the sign of fSample at a and c. If f turns around between them, check the turning point:
+//a zero there is a root of even multiplicity, and a sign change there means two close roots.
+void Search::findTangentialRoots( const Function& f, float a, float c, float fSample, bool newton, RootBuffer& root) const {
+  Derivative d(f);
+  const float da = d(a);
+  const float dc = d(c);
+  if( !((da < 0 && dc > 0) || (da > 0 && dc < 0)) ) {
+    return;
+  }
+
+  //d counts its own evaluations
+  const float x = binarySearch(d, a, c, 80, false);
+  const float fx = f(x);
+  STATS_COUNT(EVALUATIONS);
+
+  //Same threshold as binarySearch
+  if( std::fabs(fx) <= 0.0003f ) {
+    root.push(x);
+  } else if( (fx > 0) != (fSample > 0) ) {
+    STATS_COUNT_N(BRACKETS, 2);
+    root.push(refineRoot(f, a, x, newton));
+    root.push(refineRoot(f, x, c, newton));
+  }
+}
+
+//Newton steps on p, kept only while they reduce |p|. Deflated polynomials carry rounding error,
+//so roots found on them are polished against the original.
+static float polishRoot( const Polynomial& p, const Function& dp, float x) {
+  float fx = p(x);
+  STATS_COUNT(EVALUATIONS);
+  for( int i = 0; i < 3 && fx != 0; ++i) {
+    const float m = dp(x);
+    const float next = x - fx / m;
+    const float fNext = p(next);
+    STATS_COUNT_N(EVALUATIONS, 2);
+    if( !(m != 0 && std::fabs(fNext) < std::fabs(fx)) ) {
+      break;
+    }
+    x = next;
+    fx = fNext;
+  }
+  return x;
+}
+
+//Records x unless it repeats a root already found. Near a multiple root p is flat enough that
+//rounding spreads one root into several; nearby roots are the same if p stays zero between them.
+static void addDistinctRoot( const Polynomial& p, RootBuffer& root, int first, float x, float spread) {
+  for( int i = first; i < root.size(); ++i) {
+    const float gap = std::fabs(root[i] - x);
+    if( gap <= 1e-3f ) {
+      return;
+    }
+    if( gap < spread ) {
+      STATS_COUNT(EVALUATIONS);
+      if( std::fabs(p((root[i] + x) / 2.0f)) <= 0.0003f ) {
+        return;
+      }
+    }
+  }
+  root.push(x);
+}
+
+//Find the roots of a polynomial from left to right, dividing each one out of it. Later scans then run on a
+//polynomial of lower degree, and the last two roots come from the quadratic formula without any search.
+void Search::findPolynomialRoots( const Polynomial& p, float xMin, float xMax, RootBuffer& root, RootWorkspace& workspace) const {
+  const float inc = 0.2f;
+  const int first = root.size();
+  workspace.reserve(p.degree());
+  //Both reuse the workspace's storage, so that dividing out roots does not allocate
+  Polynomial& dp = workspace.derivative;
+  p.derivativeInto(dp);
+  Polynomial& q = workspace.quotient;
+  q = p;
+
+  //A scan that stops at its first roots finds at most two
+  FixedRootBuffer<2> found;
+
+  //Roots below start have been divided out, except for the remaining multiplicity of the last one
+  float start = xMin;
+  while( q.degree() > 2 ) {
+    found.clear();
+    scanRoots(q, start, xMax, inc, false, true, found);
+    if( found.size() == 0 ) {
+      break;
+    }
+    for( int i = 0; i < found.size(); ++i) {
+      const float x = polishRoot(p, dp, found[i]);
+      addDistinctRoot(p, root, first, x, inc);
+      q.deflateInto(x, q);
+      start = max(xMin, x - 2.0f * inc);
+    }
+  }
+
+  //Solve what is left directly
+  float x[2];
+  int count = 0;
+  if( q.degree() == 1 ) {
+    x[count++] = -q[0] / q[1];
+  } else if( q.degree() == 2 ) {
+    const float a = q[2];
+    const float b = q[1];
+    const float c = q[0];
+    const float discriminant = b * b - 4.0f * a * c;
+    if( discriminant > 0 ) {
+      //Avoids cancellation between -b and the square root
+      const float t = -0.5f * (b + copysignf(std::sqrt(discriminant), b));
+      x[count++] = t / a;
+      if( t != 0 ) {
+        x[count++] = c / t;
+      }
+    } else {
+      //A double root, or a near miss that rounding may have pushed below zero
+      x[count++] = -b / (2.0f * a);
+    }
+  }
+
+  for( int i = 0; i < count; ++i) {
+    if( x[i] >= xMin && x[i] <= xMax ) {
+      const float r = polishRoot(p, dp, x[i]);
+      STATS_COUNT(EVALUATIONS);
+      if( std::fabs(p(r)) <= 0.0003f ) {
+        addDistinctRoot(p, root, first, r, inc);
+      }
+    }
+  }
+
+  std::sort(root.begin() + first, root.end());
+}
+
+//Use Newton's method to find a root, falling back to bisection whenever a step would leave the bracket
+RootResult Search::newtonSearch( const Function& f, const Derivative& d, float xMin, float xMax, float err, int maxIterations) const {
+  //Orient the bracket so that f(lo) < 0 < f(hi)
+  float lo = xMin;
+  float hi = xMax;
+  if( f(xMin) > 0 ) {
+    std::swap(lo, hi);
+  }
+  STATS_COUNT(EVALUATIONS);
+
+  float x = (lo + hi) / 2.0f;
+
+  //Length of the step before last. Newton steps that do not at least halve it are replaced by bisection.
+  float oldStep = std::fabs(hi - lo);
+  float step = oldStep;
+
+  for( int iteration = 1; iteration <= maxIterations; ++iteration) {
+    STATS_COUNT(NEWTON_ITERATIONS);
+
+    //Check whether the point is a zero. d counts its own evaluations.
+    const float fx = f(x);
+    STATS_COUNT(EVALUATIONS);
+    if( std::fabs(fx) <= err ) {
+      return RootResult(x, iteration, true);
+    }
+
+    //Shrink the bracket
+    if( fx < 0 ) {
+      lo = x;
+    } else {
+      hi = x;
+    }
+
+    //The bracket cannot shrink below float resolution
+    if( std::fabs(hi - lo) <= 4.0f * FLT_EPSILON * max(std::fabs(lo), std::fabs(hi)) ) {
+      return RootResult(x, iteration, true);
+    }
+
+    //Newton step along the tangent line, unless the derivative is flat, the step leaves
+    //the bracket, or it converges too slowly
+    const float m = d(x);
+    const float newton = x - fx / m;
+    const float next = (m != 0 && std::isfinite(newton) && (newton - lo) * (newton - hi) < 0 && std::fabs(2.0f * (newton - x)) <= oldStep) ?
+      newton : (lo + hi) / 2.0f;
+
+    oldStep = step;
+    step = std::fabs(next - x);
+    x = next;
+  }
+
+  STATS_COUNT(CONVERGENCE_FAILURES);
+  return RootResult(x, maxIterations, false);
+}
 
 //Use binary search to find a root
-float Search::binarySearch( const Function& f, float xMin, float xMax, int iterations) const {
+float Search::binarySearch( const Function& f, float xMin, float xMax, int iterations, bool countEvaluations) const {
   //Error threshold
   float err = 0.0003f;
   
   //Calculate the midpoint
   float mid = (xMax + xMin) / 2.0f;
+  const float fMid = f(mid);
+  STATS_COUNT(BISECTION_STEPS);
+  if( countEvaluations ) {
+    STATS_COUNT(EVALUATIONS);
+  }
 
   //Determine whether the point is a zero and if not, which side of the midpoint should be searched for a root
-  if( std::fabs(f(mid)) <= err || iterations == 0) {
+  if( std::fabs(fMid) <= err || iterations == 0) {
+    if( std::fabs(fMid) > err ) {
+      STATS_COUNT(CONVERGENCE_FAILURES);
+    }
     return mid;
   } else {
     --iterations;
-    if( ( f(mid) < 0 && f(xMin) < 0) || ( f(mid) > 0 && f(xMin) > 0 )) {
-      return binarySearch(f, mid, xMax, iterations);
+    const float fMin = f(xMin);
+    if( countEvaluations ) {
+      STATS_COUNT(EVALUATIONS);
+    }
+    if( ( fMid < 0 && fMin < 0) || ( fMid > 0 && fMin > 0 )) {
+      return binarySearch(f, mid, xMax, iterations, countEvaluations);
     } else {
-      return binarySearch(f, xMin, mid, iterations);
+      return binarySearch(f, xMin, mid, iterations, countEvaluations);
     }
   }
 }
@@ -220,42 +584,25 @@ float Search::binarySearch( const Function& f, float xMin, float xMax, int itera
 void Search::onKeyPress( unsigned char key) {
   if( key != 27 ) {
     saveImage("MyMasterpiece.tga");
+#ifdef ROOTFINDER_STATS
+    Stats::writeJSON("MyMasterpiece-stats.json");
+    saveMarchStepHeatmap("MyMasterpiece-steps.png");
+#endif
   }
-    ::exit(0);
+  quit();
 }
 
-//Find the smallest root of a distance function to draw 3D shapes
-float Search::findSmallestRootOfDistanceFunction(const Function& f, float xMin, float xMax) const {
-  //Initialize values
-  float x = xMin;
-  float last = x;
-
-  //Minimum step
-  float inc = 1e-3;
-  
-  //Error threshold
-  float threshold = minimumDistanceToSurface;
-  
-  //Approach the surface
-  while( f(x) > 0 && x <= xMax ) {
-    last = x;
-    x = x + max( f(x), inc);
-  }
-
-  //Save highest value attempted
-  float highest = x;
-
-  //Use binary search to find root
-  if( x <= xMax ) {
-     x = binarySearch(f, last, highest, 80); 
-  }
+//Find the smallest root of a distance function to draw 3D shapes. This is the march used by
+//drawRayCastImage() for shapes of static type Shape; concrete shapes call marchToSurface() directly.
+float Search::findSmallestRootOfDistanceFunction(const Function& f, float xMin, float xMax, const RayFootprint& footprint, int maxSteps) const {
+  return marchToSurface(f, xMin, xMax, footprint, maxSteps);
+}
 
-  //Return the root
-  if( f(x) < threshold) {
-    return x;
-  } else {
-    return NAN;
-  }
+//The Mandelbulb as seen by view
+static FixedMandelbulb<6> orientedMandelbulb( const Camera& view) {
+  FixedMandelbulb<6> mandelbulb;
+  mandelbulb.setRotation(view.yaw, view.pitch, 0.5);
+  return mandelbulb;
 }
 
 //Determines what is drawn on the image
@@ -272,7 +619,23 @@ void Search::onGraphics() {
   ++frame;
   */
   
-  Mandelbulb mandelbulb(6.0f);
-  mandelbulb.setRotation(0.5, 0.5, 0.5);
-  drawRayCastImage( mandelbulb, 3.0f);  
+  //Orient the Mandelbulb by the mouse-driven camera
+  const Camera& view = camera();
+  const FixedMandelbulb<6>& mandelbulb = orientedMandelbulb(view);
+
+  //Trace coarsely enough to keep up while the camera moves, and refine when it stops
+  const RenderQuality& q = frameQuality();
+  drawRayCastImage( mandelbulb, view.zoom, q.pixelSize, q.samplesPerPixel, q.maxMarchSteps);
+}
+
+//Traces part of the image that onGraphics() draws, for a coordinator process
+void Search::renderTile( const Camera& view, const Tile& tile, Color* pixels) {
+  drawRayCastTile( orientedMandelbulb(view), view.zoom, tile, pixels);
+}
+
+//Traces one frame of an animation, whose power may vary
+void Search::renderAnimationFrame( const FrameParameters& p, Color* pixels) {
+  Mandelbulb mandelbulb(p.power);
+  mandelbulb.setRotation(p.yaw, p.pitch, p.roll);
+  drawRayCastTile( mandelbulb, p.zoom, Tile(0, 0, m_imageWidth, m_imageHeight), pixels);
 }
@@ -7,6 +7,7 @@
 #include "App.h"
 #include "Mandelbulb.h"
 #include "math3d.h"
+#include "Stats.h"
 
 class Derivative : public Function {
 
@@ -17,11 +18,74 @@ class Derivative : public Function {
 
   Derivative(const Function& f, float h = 1e-3f) : f(f), h(h) {}
   virtual float operator()(float x) const override {
+    STATS_COUNT_N(EVALUATIONS, 2);
     return (f(x+h) - f(x-h)) / (2.0f * h);
   }
 };
 
 
+/* The rows covered by a plotted curve in one pixel column. Empty if top > bottom. */
+struct ColumnSpan {
+  int top;
+  int bottom;
+
+  ColumnSpan() : top(1), bottom(0) {}
+};
+
+
+/* Samples of a function, in increasing order of x. Plotting keeps them so that root finding can
+   bracket roots without evaluating the function again. */
+struct SampledFunction {
+  std::vector<float> x;
+  std::vector<float> fx;
+};
+
+
+/* One curve for Search::plot. The function must be safe to evaluate from several threads at once. */
+struct PlotJob {
+  //How plot() finds the roots of the curve
+  enum RootMethod {
+    //Bracket the roots between the plotted samples, or divide them out of a polynomial
+    SAMPLED,
+
+    //Scan f on a grid of its own with every thread (Search::findRootsParallel), after the other curves
+    //are sampled. For a function so expensive that one search is worth dividing.
+    PARALLEL,
+
+    //From a Chebyshev proxy of f (Search::findChebyshevRoots). For a smooth function whose roots may be
+    //closer together than the samples.
+    CHEBYSHEV
+  };
+
+  const Function* f;
+  Color color;
+  float domain_s;
+  float domain_e;
+  float range_s;
+  float range_e;
+
+  //Find roots with Newton's method instead of binary search. CHEBYSHEV ignores it.
+  bool newton;
+
+  RootMethod method;
+
+  PlotJob(const Function& f, const Color& color, float domain_s, float domain_e, float range_s, float range_e, bool newton = false, RootMethod method = SAMPLED) :
+    f(&f), color(color), domain_s(domain_s), domain_e(domain_e), range_s(range_s), range_e(range_e), newton(newton), method(method) {}
+};
+
+
+/* The outcome of an iterative root search */
+struct RootResult {
+  float x;
+  int iterations;
+
+  //False if the iteration budget ran out before the tolerance was met
+  bool converged;
+
+  RootResult(float x, int iterations, bool converged) : x(x), iterations(iterations), converged(converged) {}
+};
+
+
 class Search : public App {
  private:
 
@@ -30,16 +94,12 @@ class Search : public App {
 
  public:
 
-  Search(std::string& windowCaption, int imageWidth, int imageHeight, float zoom = 2.0f, float exposureconstant = 1.0f, float imageGamma = 2.1f);
+  Search(std::string& windowCaption, int imageWidth, int imageHeight, float zoom = 2.0f, float exposureconstant = 1.0f, float imageGamma = 2.1f, Framebuffer::Format imageFormat = Framebuffer::HALF16);
 
   virtual void setPixel(int x, int y, const Color& c) override;
 
-  void setPixel(Vector2 point, const Color& c);
-
   virtual Color pixel(int x, int y) const override;
 
-  Color pixel(Vector2 point) const;
-
   virtual void drawLine(int x0, int y0, int x1, int y1, const Color& c) override;
 
   void drawLine(Vector2 point0, Vector2 point1, const Color& c);
@@ -49,36 +109,94 @@ class Search : public App {
 
   virtual void onGraphics() override;
 
+  virtual void renderTile( const Camera& view, const Tile& tile, Color* pixels) override;
+
+  virtual void renderAnimationFrame( const FrameParameters& p, Color* pixels) override;
+
   void drawAxes( float hashMarks_x, float hashMarks_y, const Color& c);
 
-  void plot( Function& f, float domain_s, float domain_e, float range_s, float range_e, Color c, bool newton = false);
+  //Takes oversample samples of f per pixel column
+  void plot( Function& f, float domain_s, float domain_e, float range_s, float range_e, Color c, bool newton = false, int oversample = 4);
+
+  //Plots every job, sampling curves and finding roots in parallel, then draws them all in job order.
+  //Jobs that find their roots with PlotJob::PARALLEL search one at a time, each on every thread.
+  void plot( const std::vector<PlotJob>& jobs, int oversample = 4);
 
-  virtual void findRoots( const Function& f, float xMin, float xMax, std::vector<float>& root) const override;
+  //Evaluates f in one batch and stores the samples and the rows the curve covers in each pixel column
+  void sampleCurve( const Function& f, float domain_s, float domain_e, int oversample, std::vector<ColumnSpan>& spans, SampledFunction& samples) const;
 
-  float binarySearch( const Function& f, float xMin, float xMax, int iterations) const;
+  void drawSpans( const std::vector<ColumnSpan>& spans, const Color& c);
 
-  virtual float findSmallestRootOfDistanceFunction(const Function& f, float xMin, float xMax) const override;
+  using App::findRoots;
+
+  virtual void findRoots( const Function& f, float xMin, float xMax, RootBuffer& root, RootWorkspace& workspace) const override;
+
+  //Pass countEvaluations = false for an f that records its own evaluations, such as a Derivative
+  float binarySearch( const Function& f, float xMin, float xMax, int iterations, bool countEvaluations = true) const;
+
+  virtual float findSmallestRootOfDistanceFunction(const Function& f, float xMin, float xMax, const RayFootprint& footprint = RayFootprint(), int maxSteps = 0) const override;
 
   virtual void onKeyPress( unsigned char key) override;
 
   void findRoots_N( const Function& f, float xMin, float xMax, std::vector<float>& root) const;
 
-  float newtonSearch( const Function& f, const Derivative& d, float x, float err = 1e-5f) const;
+  //Does not allocate
+  void findRoots_N( const Function& f, float xMin, float xMax, RootBuffer& root) const;
+
+  //Scans for sign changes and for tangential roots at minima of |f|. With firstOnly, stops at the first roots found.
+  void scanRoots( const Function& f, float xMin, float xMax, float inc, bool newton, bool firstOnly, RootBuffer& root) const;
+
+  //Takes steps [first, last) of scanRoots. Each step reports only the roots in its own interval.
+  void scanSteps( const Function& f, float xMin, float inc, int first, int last, bool newton, bool firstOnly, RootBuffer& root) const;
+
+  //Checks the interval [x, xNext] for roots, given f at x and at the samples either side of it
+  void scanStep( const Function& f, float xPrev, float x, float xNext, float fPrev, float fx, float fNext, bool newton, RootBuffer& root) const;
+
+  //Finds the roots of f on [xMin, xMax] from samples of it that cover the interval, as scanRoots does
+  //from its own samples. Finer samples find roots that are closer together.
+  void findSampledRoots( const Function& f, const SampledFunction& samples, float xMin, float xMax, bool newton, RootBuffer& root) const;
+
+  //Appends the roots findRoots (or findRoots_N with newton) finds, sorted and each once, searching on all threads.
+  //For functions expensive enough that one search is worth dividing. f must be safe to evaluate from several threads at once.
+  void findRootsParallel( const Function& f, float xMin, float xMax, std::vector<float>& root, bool newton = false);
+
+  float refineRoot( const Function& f, float xMin, float xMax, bool newton) const;
+
+  //Roots of even multiplicity, or close pairs, between samples a and c where f has the sign of fSample
+  void findTangentialRoots( const Function& f, float a, float c, float fSample, bool newton, RootBuffer& root) const;
+
+  //Appends the roots of a smooth f, in increasing order, found from a piecewise Chebyshev proxy of it. Takes
+  //a small fixed number of evaluations per piece and resolves roots closer together than the scan steps.
+  //Falls back to scanRoots if f is too rough for the proxy to converge.
+  void findChebyshevRoots( const Function& f, float xMin, float xMax, std::vector<float>& root) const;
+
+  //Finds each distinct root once, in increasing order, deflating p in workspace as it goes
+  void findPolynomialRoots( const Polynomial& p, float xMin, float xMax, RootBuffer& root, RootWorkspace& workspace) const;
+
+  //Newton's method safeguarded by bisection. [xMin, xMax] must bracket a sign change of f.
+  //Iterates stay inside the bracket, and each iteration costs at most three evaluations of f.
+  RootResult newtonSearch( const Function& f, const Derivative& d, float xMin, float xMax, float err = 1e-5f, int maxIterations = 40) const;
 
 };
 
-class Cubic : public Function {
+class Cubic : public Polynomial {
 protected:
   float a, b, c, d;
 
 public:
 
- Cubic(float a, float b, float c, float d) : a(a), b(b), c(c), d(d) {}
+ Cubic(float a, float b, float c, float d) : Polynomial(std::vector<float>{d, c, b, a}), a(a), b(b), c(c), d(d) {}
 
     virtual float operator()(float x) const override {
         return a * x * x * x + b * x * x + c * x + d;
     }
 
+    virtual void evaluate(const float* x, float* y, int count) const override {
+        for (int i = 0; i < count; ++i) {
+            y[i] = ((a * x[i] + b) * x[i] + c) * x[i] + d;
+        }
+    }
+
 };
 
 #endif
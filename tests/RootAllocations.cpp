@@ -0,0 +1,87 @@
+// Bryan Jones and Melanie Subbiah (2014)
+// All rights reserved
+
+/* Checks that the root finders do not allocate once their buffer and
+   workspace exist, by counting calls to operator new. Build it from the
+   top directory with every source except main.cpp:
+
+       g++ -std=c++11 -O2 -I. tests/RootAllocations.cpp $(ls *.cpp | grep -v main.cpp) \
+           -o RootAllocations -lglut -lGL -lz -lpthread
+
+   It prints the allocations made and exits with 1 if there were any. */
+
+#include "Search.h"
+#include <new>
+#include <stdio.h>
+#include <stdlib.h>
+
+static long allocations = 0;
+
+void* operator new(size_t n) {
+    ++allocations;
+    void* p = malloc(n ? n : 1);
+    if (! p) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void operator delete(void* p) noexcept {
+    free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+    free(p);
+}
+
+class Wave : public Function {
+public:
+    virtual float operator()(float x) const override {
+        return sinf(3.0f * x) + 0.3f * x;
+    }
+};
+
+/* One call of each root finder */
+static void findAll(const Search& search, const Polynomial& quintic, const Cubic& cubic, const Wave& wave,
+                    RootBuffer& root, RootWorkspace& workspace) {
+    root.clear();
+    search.findRoots(quintic, -4.0f, 4.0f, root, workspace);
+    root.clear();
+    search.findRoots(cubic, -4.0f, 4.0f, root, workspace);
+    root.clear();
+    search.findRoots(wave, -4.0f, 4.0f, root, workspace);
+    root.clear();
+    search.findRoots_N(wave, -4.0f, 4.0f, root);
+}
+
+
+int main() {
+    std::string caption = "RootAllocations";
+    Search search(caption, 64, 64);
+
+    const Polynomial quintic(std::vector<float>{0.5f, -3.0f, -1.0f, 4.0f, 1.0f, -1.0f});
+    const Cubic cubic(-1.0f, 0.0f, 1.0f, 0.0f);
+    const Wave wave;
+
+    RootWorkspace workspace;
+    FixedRootBuffer<16> root;
+
+    /* The guarantee is per call, so one-time initialization on the first
+       call (such as a stats build registering this thread) is not counted */
+    findAll(search, quintic, cubic, wave, root, workspace);
+
+    const int calls = 10000;
+    const long before = allocations;
+    for (int i = 0; i < calls; ++i) {
+        findAll(search, quintic, cubic, wave, root, workspace);
+    }
+    const long made = allocations - before;
+    printf("%ld allocations in %d calls\n", made, 4 * calls);
+
+    /* A buffer that overflows still counts every root */
+    FixedRootBuffer<1> tiny;
+    search.findRoots(wave, -4.0f, 4.0f, tiny, workspace);
+    printf("%d of %d roots kept in a buffer of one\n", tiny.size(), tiny.found());
+
+    return (made == 0 && tiny.overflowed()) ? 0 : 1;
+}